@@ -0,0 +1,417 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Replays a query log of k-node groups against a graph and reports throughput,
+ * tail latency and result sizes. Unlike the micro benchmarks, the lists come from
+ * one shared graph, so the query mix, list reuse and the cache pollution between
+ * queries all show up in the numbers. The drivers that only read their input run
+ * on views of the graph lists, the others on copies whose cost is reported apart.
+ *
+ *   query_log_replay [--graph edges.txt | --nodes N --degree D]
+ *                    [--queries log.txt | --query-count Q --k K]
+ *                    [--algorithm NAME] [--threads T] [--repeat R] [--seed S] [--sizes out.txt] [--instrument]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "std_set_intersection.h"
+#include "galloping_search.h"
+#include "binary_search.h"
+#include "less_branching.h"
+#include "intersection_view.h"
+#include "fixed_k_intersection.h"
+#include "instrumentation.h"
+
+using graph = std::unordered_map<uint64_t, std::vector<uint64_t>>;
+using query = std::vector<uint64_t>;
+using views = std::vector<std::span<const uint64_t>>;
+
+/**
+ * A driver runs either on views of the graph lists, when it never writes to them,
+ * or on copies, when it reorders or overwrites its input. Exactly one is set.
+ */
+struct algorithm {
+    std::function<std::vector<uint64_t>(const views&)> on_views;
+    std::function<std::vector<uint64_t>(std::vector<std::vector<uint64_t>>&)> on_copies;
+};
+
+// The std drivers have no kernel of ours to instrument, they are the same in both sets
+template <typename Instrument>
+static std::map<std::string, algorithm> make_algorithms() {
+    return {
+            {"ranges_set_intersection", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_ranges_set_intersection(nums); }}},
+            {"set_intersection_in_place", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_set_intersection_in_place(nums); }}},
+            {"galloping_search", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_galloping_search<Instrument>(nums); }}},
+            {"binary_search", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_binary_search<Instrument>(nums); }}},
+            {"less_branching", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_less_branching<Instrument>(nums); }}},
+            {"less_branching_unrolled", {.on_views = nullptr, .on_copies = [](auto& nums) { return using_less_branching_unrolled<Instrument>(nums); }}},
+            {"intersection_view", {.on_views = [](auto& lists) { return using_intersection_view<Instrument>(lists); }, .on_copies = nullptr}},
+            {"fixed_k", {.on_views = [](auto& lists) { return using_fixed_k<Instrument>(lists); }, .on_copies = nullptr}},
+    };
+}
+
+static const std::map<std::string, algorithm> algorithms = make_algorithms<no_instrumentation>();
+static const std::map<std::string, algorithm> instrumented_algorithms = make_algorithms<thread_instrumentation>();
+
+struct options {
+    std::string graph_path;
+    uint64_t nodes = 100000;
+    uint64_t degree = 16;
+    std::string queries_path;
+    uint64_t query_count = 100000;
+    uint64_t k = 4;
+    std::string algorithm_name = "galloping_search";
+    uint64_t threads = 1;
+    uint64_t repeat = 1;
+    uint64_t seed = 42;
+    std::string sizes_path;
+    bool instrument = false;
+};
+
+// Neighbours become sorted lists without repeats, the layout every driver expects
+static void finish_graph(graph& g) {
+    for (auto& [node, neighbours] : g) {
+        std::ranges::sort(neighbours);
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    }
+}
+
+/**
+ * Undirected graph from a "from to" edge per line, as in the SNAP and KONECT dumps.
+ * Lines starting with # or % are comments.
+ */
+static graph load_graph(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("could not open " + path);
+    }
+    graph g;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#' || line[0] == '%') {
+            continue;
+        }
+        std::istringstream edge(line);
+        uint64_t from, to;
+        if (edge >> from >> to && from != to) {
+            g[from].push_back(to);
+            g[to].push_back(from);
+        }
+    }
+    finish_graph(g);
+    return g;
+}
+
+/**
+ * Preferential attachment (Barabasi-Albert): every new node links to `degree` nodes
+ * picked in proportion to their degree, which gives power law degrees with a few
+ * huge lists and many small ones.
+ */
+static graph generate_graph(uint64_t nodes, uint64_t degree, std::mt19937_64& random_engine) {
+    graph g;
+    std::vector<uint64_t> endpoints;   // every node once per edge it has
+    for (uint64_t node = 0; node <= degree && node < nodes; node++) {
+        for (uint64_t other = 0; other < node; other++) {
+            g[node].push_back(other);
+            g[other].push_back(node);
+            endpoints.push_back(node);
+            endpoints.push_back(other);
+        }
+    }
+    for (uint64_t node = degree + 1; node < nodes; node++) {
+        std::uniform_int_distribution<size_t> pick(0, endpoints.size() - 1);
+        for (uint64_t edge = 0; edge < degree; edge++) {
+            uint64_t other = endpoints[pick(random_engine)];
+            g[node].push_back(other);
+            g[other].push_back(node);
+            endpoints.push_back(node);
+            endpoints.push_back(other);
+        }
+    }
+    finish_graph(g);
+    return g;
+}
+
+// Repeated nodes in a group add nothing, and a group needs two nodes to intersect
+static void add_query(std::vector<query>& log, query q) {
+    std::ranges::sort(q);
+    q.erase(std::unique(q.begin(), q.end()), q.end());
+    if (q.size() >= 2) {
+        log.emplace_back(std::move(q));
+    }
+}
+
+// One group of node ids per line
+static std::vector<query> load_queries(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("could not open " + path);
+    }
+    std::vector<query> log;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream ids(line);
+        query q;
+        for (uint64_t id; ids >> id;) {
+            q.push_back(id);
+        }
+        add_query(log, std::move(q));
+    }
+    return log;
+}
+
+/**
+ * Groups of 2 to k nodes, each picked in proportion to its degree, so the popular
+ * (and largest) lists come back again and again like they do in real traffic.
+ */
+static std::vector<query> generate_queries(const graph& g, uint64_t count, uint64_t k, std::mt19937_64& random_engine) {
+    std::vector<uint64_t> endpoints;
+    for (auto& [node, neighbours] : g) {
+        endpoints.insert(endpoints.end(), neighbours.size(), node);
+    }
+    std::vector<query> log;
+    if (endpoints.empty()) {
+        return log;
+    }
+    std::uniform_int_distribution<size_t> pick(0, endpoints.size() - 1);
+    std::uniform_int_distribution<uint64_t> group(2, std::max<uint64_t>(k, 2));
+    while (log.size() < count) {
+        query q(group(random_engine));
+        for (auto& node : q) {
+            node = endpoints[pick(random_engine)];
+        }
+        add_query(log, std::move(q));
+    }
+    return log;
+}
+
+struct replay_stats {
+    histogram_snapshot latency;       // nanoseconds per query, the sum of the two below
+    histogram_snapshot gather;        // nanoseconds to find the lists, and copy them for on_copies
+    histogram_snapshot run;           // nanoseconds in the driver
+    histogram_snapshot result_size;   // ids per query, bucket 0 counts the empty answers
+    double seconds = 0;
+};
+
+/**
+ * Runs the log `repeat` times over `threads` threads that take the next query from a
+ * shared counter. Each thread records into its own histograms, merged at the end.
+ * The clock of a query is split in two: the gather looks up its lists in the graph
+ * (and copies them for the drivers that need copies), the run is the driver itself.
+ * Both are reported and their sum is the latency, so it covers the same work as the throughput.
+ */
+static replay_stats replay(const graph& g, const std::vector<query>& log, const algorithm& algorithm, const options& opts,
+                           std::vector<uint64_t>& sizes, std::vector<uint64_t>& latencies, std::vector<uint64_t>& gathers) {
+    const uint64_t total = log.size() * opts.repeat;
+    std::atomic<uint64_t> next{0};
+    std::vector<latency_histogram> latency(opts.threads);
+    std::vector<latency_histogram> gather(opts.threads);
+    std::vector<latency_histogram> run(opts.threads);
+    std::vector<latency_histogram> result_size(opts.threads);
+
+    auto nanoseconds = [](auto elapsed) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    };
+
+    auto worker = [&](size_t thread) {
+        views lists;
+        std::vector<std::vector<uint64_t>> nums;
+        for (uint64_t i = next.fetch_add(1, std::memory_order_relaxed); i < total; i = next.fetch_add(1, std::memory_order_relaxed)) {
+            auto& q = log[i % log.size()];
+            auto start = std::chrono::steady_clock::now();
+            lists.clear();
+            for (auto node : q) {
+                auto found = g.find(node);
+                lists.emplace_back(found == g.end() ? std::span<const uint64_t>() : std::span<const uint64_t>(found->second));
+            }
+            if (algorithm.on_copies) {
+                nums.clear();
+                for (auto list : lists) {
+                    nums.emplace_back(list.begin(), list.end());
+                }
+            }
+            auto gathered = std::chrono::steady_clock::now();
+            auto result = algorithm.on_copies ? algorithm.on_copies(nums) : algorithm.on_views(lists);
+            auto finished = std::chrono::steady_clock::now();
+
+            auto query_nanoseconds = nanoseconds(finished - start);
+            auto gather_nanoseconds = nanoseconds(gathered - start);
+            latency[thread].record(query_nanoseconds);
+            gather[thread].record(gather_nanoseconds);
+            run[thread].record(nanoseconds(finished - gathered));
+            result_size[thread].record(result.size());
+            // the last pass over the log is the one kept per query
+            if (i >= total - log.size()) {
+                sizes[i % log.size()] = result.size();
+                latencies[i % log.size()] = query_nanoseconds;
+                gathers[i % log.size()] = gather_nanoseconds;
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (size_t thread = 1; thread < opts.threads; thread++) {
+        pool.emplace_back(worker, thread);
+    }
+    worker(0);
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    replay_stats stats;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t thread = 0; thread < opts.threads; thread++) {
+        stats.latency.merge(latency[thread].snapshot());
+        stats.gather.merge(gather[thread].snapshot());
+        stats.run.merge(run[thread].snapshot());
+        stats.result_size.merge(result_size[thread].snapshot());
+    }
+    return stats;
+}
+
+static void print_latency(const char * label, const histogram_snapshot& latency) {
+    std::cout << label << " p50=" << latency.percentile(50)
+              << " p90=" << latency.percentile(90)
+              << " p99=" << latency.percentile(99)
+              << " p99.9=" << latency.percentile(99.9)
+              << " max=" << latency.max << "\n";
+}
+
+static void usage(const char * name) {
+    std::cerr << "usage: " << name << " [--graph edges.txt | --nodes N --degree D]\n"
+              << "       [--queries log.txt | --query-count Q --k K]\n"
+              << "       [--algorithm NAME] [--threads T] [--repeat R] [--seed S] [--sizes out.txt] [--instrument]\n"
+              << "algorithms:";
+    for (auto& [algorithm_name, algorithm] : algorithms) {
+        std::cerr << " " << algorithm_name;
+    }
+    std::cerr << "\n";
+}
+
+static bool parse(int argc, char ** argv, options& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--instrument") {
+            opts.instrument = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (flag == "--graph") opts.graph_path = value;
+        else if (flag == "--queries") opts.queries_path = value;
+        else if (flag == "--algorithm") opts.algorithm_name = value;
+        else if (flag == "--sizes") opts.sizes_path = value;
+        else {
+            uint64_t number;
+            try {
+                number = std::stoull(value);
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (flag == "--nodes") opts.nodes = number;
+            else if (flag == "--degree") opts.degree = number;
+            else if (flag == "--query-count") opts.query_count = number;
+            else if (flag == "--k") opts.k = number;
+            else if (flag == "--threads") opts.threads = std::max<uint64_t>(number, 1);
+            else if (flag == "--repeat") opts.repeat = std::max<uint64_t>(number, 1);
+            else if (flag == "--seed") opts.seed = number;
+            else return false;
+        }
+    }
+    return algorithms.contains(opts.algorithm_name);
+}
+
+int main(int argc, char ** argv) {
+    options opts;
+    if (!parse(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::mt19937_64 random_engine{opts.seed};
+    graph g;
+    std::vector<query> log;
+    try {
+        g = opts.graph_path.empty() ? generate_graph(opts.nodes, opts.degree, random_engine) : load_graph(opts.graph_path);
+        log = opts.queries_path.empty() ? generate_queries(g, opts.query_count, opts.k, random_engine) : load_queries(opts.queries_path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    if (log.empty()) {
+        std::cerr << "the query log is empty\n";
+        return 1;
+    }
+
+    uint64_t edges = 0;
+    uint64_t largest = 0;
+    for (auto& [node, neighbours] : g) {
+        edges += neighbours.size();
+        largest = std::max<uint64_t>(largest, neighbours.size());
+    }
+    std::cout << "graph: " << g.size() << " nodes, " << edges / 2 << " edges, largest list " << largest << "\n"
+              << "log: " << log.size() << " queries x " << opts.repeat << ", algorithm " << opts.algorithm_name
+              << ", " << opts.threads << " thread(s)\n";
+
+    std::vector<uint64_t> sizes(log.size());
+    std::vector<uint64_t> latencies(log.size());
+    std::vector<uint64_t> gathers(log.size());
+    auto& algorithm = (opts.instrument ? instrumented_algorithms : algorithms).at(opts.algorithm_name);
+    auto stats = replay(g, log, algorithm, opts, sizes, latencies, gathers);
+
+    auto queries = static_cast<double>(stats.latency.total);
+    std::cout << "throughput: " << queries / stats.seconds << " queries/s (" << stats.seconds << " s)\n";
+    print_latency("latency ns:", stats.latency);
+    print_latency(algorithm.on_copies ? "  gather ns (lookups and copies):" : "  gather ns (lookups):", stats.gather);
+    print_latency("  run ns:", stats.run);
+    std::cout << "result size: p50=" << stats.result_size.percentile(50)
+              << " p90=" << stats.result_size.percentile(90)
+              << " p99=" << stats.result_size.percentile(99)
+              << " max=" << stats.result_size.max
+              << " empty=" << 100.0 * static_cast<double>(stats.result_size.counts[0]) / queries << "%\n";
+    if (opts.instrument) {
+        dump_instrumentation(std::cout);
+    }
+
+    if (!opts.sizes_path.empty()) {
+        std::ofstream out(opts.sizes_path);
+        out << "# query k result_size latency_ns gather_ns\n";
+        for (size_t i = 0; i < log.size(); i++) {
+            out << i << " " << log[i].size() << " " << sizes[i] << " " << latencies[i] << " " << gathers[i] << "\n";
+        }
+    }
+    return 0;
+}
@@ -17,6 +17,8 @@
 #ifndef MULTIPLE_INTERSECTIONS_BINARY_SEARCH_H
 #define MULTIPLE_INTERSECTIONS_BINARY_SEARCH_H
 
+#include "instrumentation.h"
+
 /**
  * This is pure binary search
  * Used by BSintersectioncardinality below
@@ -25,22 +27,29 @@
  * @param min
  * @return
  */
+template <typename Instrument = no_instrumentation>
 static size_t bs_advance_until(const uint64_t * array, const size_t pos,
                                const size_t length, const size_t min) {
     size_t lower = pos + 1;
     if (lower == length || array[lower] >= min) {
+        Instrument::comparisons(BINARY_SEARCH_KERNEL, 1);
         return lower;
     }
     // can safely assume that length>0
     size_t upper = length - 1;
     if (array[upper] < min) {
+        Instrument::comparisons(BINARY_SEARCH_KERNEL, 2);
+        Instrument::skipped(BINARY_SEARCH_KERNEL, length - pos - 1);
         return length;
     }
     size_t mid;
+    size_t depth = 0;
     while (lower < upper) {
         mid = (lower + upper) / 2;
+        ++depth;
         if (array[mid] == min) {
-            return mid;
+            upper = mid;
+            break;
         }
 
         if (array[mid] < min) {
@@ -49,28 +58,35 @@ static size_t bs_advance_until(const uint64_t * array, const size_t pos,
             upper = mid;
         }
     }
+    Instrument::search_steps(BINARY_SEARCH_KERNEL, depth);
+    Instrument::comparisons(BINARY_SEARCH_KERNEL, depth + 2);
+    Instrument::skipped(BINARY_SEARCH_KERNEL, upper - pos - 1);
     return upper;
 }
 
 /**
  * Based on binary search.
  */
+template <typename Instrument = no_instrumentation>
 size_t binary_search_intersection(const uint64_t * set1, const size_t length1,
                       const uint64_t * set2, const size_t length2, uint64_t *out) {
+    typename Instrument::timer timer(BINARY_SEARCH_KERNEL);
     if ((0 == length1) or (0 == length2))
         return 0;
     size_t answer = 0;
     size_t k1 = 0, k2 = 0;
+    size_t compares = 0;
     while (true) {
+        compares += 2;
         if (set1[k1] < set2[k2]) {
-            k1 = bs_advance_until(set1, k1, length1, set2[k2]);
+            k1 = bs_advance_until<Instrument>(set1, k1, length1, set2[k2]);
             if (k1 == length1)
-                return answer;
+                break;
         }
         if (set2[k2] < set1[k1]) {
-            k2 = bs_advance_until(set2, k2, length2, set1[k1]);
+            k2 = bs_advance_until<Instrument>(set2, k2, length2, set1[k1]);
             if (k2 == length2)
-                return answer;
+                break;
         } else {
             out[answer++] = set1[k1];
             ++k1;
@@ -81,9 +97,12 @@ size_t binary_search_intersection(const uint64_t * set1, const size_t length1,
                 break;
         }
     }
+    Instrument::comparisons(BINARY_SEARCH_KERNEL, compares);
+    Instrument::output(BINARY_SEARCH_KERNEL, answer);
     return answer;
 }
 
+template <typename Instrument = no_instrumentation>
 std::vector<uint64_t> using_binary_search(std::vector<std::vector<uint64_t>>& nums) {
 
     // 1. Check if any index is empty, if so then the intersection is empty
@@ -106,7 +125,7 @@ std::vector<uint64_t> using_binary_search(std::vector<std::vector<uint64_t>>& nu
         // here we can change the intersection function to any regular scalar
         // or vector pair-set intersection algorithms.
         size_t inter_length =
-                binary_search_intersection(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
+                binary_search_intersection<Instrument>(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
         result.resize(inter_length);
     }
     return result;
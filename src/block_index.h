@@ -0,0 +1,199 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_BLOCK_INDEX_H
+#define MULTIPLE_INTERSECTIONS_BLOCK_INDEX_H
+
+#include <span>
+#include <vector>
+#include <algorithm>
+#include "instrumentation.h"
+
+const size_t BLOCK_SIZE = 64;
+
+/**
+ * Zone map over a sorted list: the max id of every BLOCK_SIZE ids.
+ * The list itself stays a plain array of uint64_t.
+ */
+std::vector<uint64_t> build_block_maxes(const uint64_t * set, const size_t length) {
+    std::vector<uint64_t> maxes;
+    maxes.reserve((length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for (size_t end = BLOCK_SIZE; end < length + BLOCK_SIZE; end += BLOCK_SIZE) {
+        maxes.push_back(set[std::min(end, length) - 1]);
+    }
+    return maxes;
+}
+
+/**
+ * A sorted list and its block maxes, kept together so that reordering the lists
+ * can never pair a list with the maxes of another one.
+ * The ids are not copied, the list must outlive the index like for intersection_view.
+ * Moving the vector that owns the ids (as the drivers sorting nums do) keeps them where they are.
+ */
+struct block_indexed_list {
+    std::span<const uint64_t> ids;
+    std::vector<uint64_t> maxes;
+};
+
+block_indexed_list build_block_index(std::span<const uint64_t> list) {
+    return {list, build_block_maxes(list.data(), list.size())};
+}
+
+std::vector<block_indexed_list> build_block_index(const std::vector<std::vector<uint64_t>>& nums) {
+    std::vector<block_indexed_list> lists;
+    lists.reserve(nums.size());
+    for (auto& list : nums) {
+        lists.emplace_back(build_block_index(list));
+    }
+    return lists;
+}
+
+/**
+ * Find the first block at or after block whose max is >= min.
+ * The maxes are sorted, so the number of maxes below min in a group of 4
+ * is how far to move, counted without branches so the compiler can use SIMD.
+ */
+static size_t block_advance_until(const uint64_t * maxes, size_t block,
+                                  const size_t blocks, const uint64_t min) {
+    while (block + 4 <= blocks) {
+        size_t below = static_cast<size_t>(maxes[block] < min) + static_cast<size_t>(maxes[block + 1] < min)
+                + static_cast<size_t>(maxes[block + 2] < min) + static_cast<size_t>(maxes[block + 3] < min);
+        block += below;
+        if (below < 4) {
+            return block;
+        }
+    }
+    while (block < blocks && maxes[block] < min) {
+        ++block;
+    }
+    return block;
+}
+
+// same as BRANCHLESSMATCH in less_branching.h
+#define BLOCKMATCH() {                          \
+        int m = (*pB == *pA) ? 1 : 0;           \
+        int next_a = (*pB >= *pA) ? 1 : 0;      \
+        int next_b = (*pB <= *pA) ? 1 : 0;      \
+        *Match = *pA;                           \
+        Match += m;                             \
+        pA += next_a;                           \
+        pB += next_b;                           \
+    }
+
+/**
+ * Branchless merge like scalar_branchless, but at every block boundary the
+ * block maxes are used to jump over whole blocks that cannot hold a match.
+ * Only the overlapping block pairs are walked element by element.
+ * Instrumented, the ids jumped over count as skipped and the merge steps as comparisons.
+ */
+template <typename Instrument = no_instrumentation>
+size_t block_skipping_intersection(const uint64_t * A, const size_t lenA, const uint64_t * maxesA,
+                                   const uint64_t * B, const size_t lenB, const uint64_t * maxesB,
+                                   uint64_t * Match) {
+    typename Instrument::timer timer(BLOCK_SKIPPING_KERNEL);
+    const uint64_t * initMatch = Match;
+    const size_t blocksA = (lenA + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const size_t blocksB = (lenB + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t a = 0, b = 0;
+    size_t skipped = 0;
+    size_t steps = 0;
+
+    while (a < lenA && b < lenB) {
+        // 1. Skip the blocks of A that end before the current id of B, and the other way around
+        size_t blockA = block_advance_until(maxesA, a / BLOCK_SIZE, blocksA, B[b]);
+        if (blockA == blocksA) {
+            skipped += lenA - a;
+            break;
+        }
+        skipped += std::max(a, blockA * BLOCK_SIZE) - a;
+        a = std::max(a, blockA * BLOCK_SIZE);
+
+        size_t blockB = block_advance_until(maxesB, b / BLOCK_SIZE, blocksB, A[a]);
+        if (blockB == blocksB) {
+            skipped += lenB - b;
+            break;
+        }
+        skipped += std::max(b, blockB * BLOCK_SIZE) - b;
+        b = std::max(b, blockB * BLOCK_SIZE);
+
+        // 2. Merge until one of the two blocks runs out
+        const uint64_t * pA = A + a;
+        const uint64_t * pB = B + b;
+        const uint64_t * endA = A + std::min((a / BLOCK_SIZE + 1) * BLOCK_SIZE, lenA);
+        const uint64_t * endB = B + std::min((b / BLOCK_SIZE + 1) * BLOCK_SIZE, lenB);
+        while (pA + 4 <= endA && pB + 4 <= endB) {
+            BLOCKMATCH();  // 4 steps move each pointer at most 4 places
+            BLOCKMATCH();
+            BLOCKMATCH();
+            BLOCKMATCH();
+        }
+        while (pA < endA && pB < endB) {
+            BLOCKMATCH();
+        }
+        steps += static_cast<size_t>((pA - (A + a)) + (pB - (B + b)));
+        a = pA - A;
+        b = pB - B;
+    }
+
+    size_t count = Match - initMatch;
+    // a match is one step that moved both A and B
+    Instrument::comparisons(BLOCK_SKIPPING_KERNEL, steps - count);
+    Instrument::skipped(BLOCK_SKIPPING_KERNEL, skipped);
+    Instrument::output(BLOCK_SKIPPING_KERNEL, count);
+    return count;
+}
+
+#undef BLOCKMATCH
+
+/**
+ * The block maxes are built once next to the data, and travel with their list.
+ * The intermediate result gets its own maxes each round, which only reads one id per block.
+ */
+template <typename Instrument = no_instrumentation>
+std::vector<uint64_t> using_block_index(std::vector<block_indexed_list>& lists) {
+
+    // 1. Check if any index is empty, if so then the intersection is empty
+    for (auto& index : lists) {
+        if (index.ids.empty()) {
+            return {};
+        }
+    }
+
+    // 2. Sort indexes by their first value, the maxes move with them
+    std::sort(lists.begin(), lists.end(), [](auto& left, auto& right) {
+        return std::ranges::lexicographical_compare(left.ids, right.ids);
+    });
+
+    // 3. Swap the 2nd vector for the last one to try to eliminate a bunch right away
+    std::swap(lists.at(1), lists.at(lists.size() - 1));
+
+    // initialize by the first vector
+    std::vector<uint64_t> result(lists[0].ids.begin(), lists[0].ids.end());
+    std::vector<uint64_t> result_maxes = lists[0].maxes;
+
+    for (size_t i = 1; i < lists.size(); ++i) {
+        auto& list = lists[i];
+        size_t inter_length =
+                block_skipping_intersection<Instrument>(result.data(), result.size(), result_maxes.data(),
+                                            list.ids.data(), list.ids.size(), list.maxes.data(), result.data());
+        result.resize(inter_length);
+        if (result.empty()) return result;
+        result_maxes = build_block_maxes(result.data(), result.size());
+    }
+    return result;
+}
+
+#endif //MULTIPLE_INTERSECTIONS_BLOCK_INDEX_H
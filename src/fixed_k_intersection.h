@@ -0,0 +1,157 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_FIXED_K_INTERSECTION_H
+#define MULTIPLE_INTERSECTIONS_FIXED_K_INTERSECTION_H
+
+#include <span>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "less_branching.h"
+
+/**
+ * Move one cursor up to the first id >= high.
+ * Returns false when the list runs out. A head past high becomes the new high.
+ */
+static inline bool fixed_k_catch_up(const uint64_t *& list, const uint64_t * end, uint64_t& high, size_t& agree) {
+    while (*list < high) {
+        if (++list == end) {
+            return false;
+        }
+    }
+    if (*list == high) {
+        ++agree;
+    } else {
+        high = *list;
+        agree = 1;
+    }
+    return true;
+}
+
+/**
+ * Merge of K lists at once, with the per list work unrolled by fold expressions
+ * so the K cursors stay in registers and each match is written once, with no
+ * intermediate results.
+ * Every list in turn catches up to the highest head seen so far, until K lists
+ * in a row agree on it. Then it is a match and all the lists move on.
+ *
+ * A branchless version (K list BRANCHLESSMATCH) was slower: its loads wait on
+ * the max of the heads, while these sorted walks are easy to branch predict.
+ * Instrumented, every id a cursor moves past counts as a comparison.
+ */
+template <typename Instrument, size_t K, size_t... I>
+size_t fixed_k_intersection(std::array<const uint64_t *, K> lists, const std::array<const uint64_t *, K> ends,
+                            uint64_t * Match, std::index_sequence<I...>) {
+    typename Instrument::timer timer(FIXED_K_KERNEL);
+    const std::array<const uint64_t *, K> starts = lists;
+    const uint64_t * initMatch = Match;
+    if (!((lists[I] < ends[I]) && ...)) {
+        return 0;
+    }
+
+    uint64_t high = *lists[0];
+    size_t agree = 0;
+    while (true) {
+        if (!(fixed_k_catch_up(lists[I], ends[I], high, agree) && ...)) {
+            break;
+        }
+        if (agree >= K) {
+            *Match++ = high;
+            if (!((++lists[I] < ends[I]) & ...)) {
+                break;
+            }
+            high = *lists[0];
+            agree = 0;
+        }
+    }
+
+    size_t count = Match - initMatch;
+    Instrument::comparisons(FIXED_K_KERNEL, static_cast<uint64_t>(((lists[I] - starts[I]) + ...)));
+    Instrument::output(FIXED_K_KERNEL, count);
+    return count;
+}
+
+template <typename Instrument, size_t K, class Lists>
+size_t fixed_k_intersection(const Lists& nums, uint64_t * Match) {
+    std::array<const uint64_t *, K> lists;
+    std::array<const uint64_t *, K> ends;
+    for (size_t i = 0; i < K; ++i) {
+        lists[i] = nums[i].data();
+        ends[i] = nums[i].data() + nums[i].size();
+    }
+    return fixed_k_intersection<Instrument, K>(lists, ends, Match, std::make_index_sequence<K>());
+}
+
+/**
+ * Runtime switch into the specialized kernels for 2 to 8 lists.
+ * The lists are only read, so they can be vectors or spans over lists owned elsewhere.
+ * Past 8 lists the first 8 go through the kernel and the rest are pairwise.
+ * Match needs room for the smallest of the first 8 lists, which need not be the
+ * smallest list: the kernel writes before the later lists can shrink the result.
+ */
+template <typename Instrument = no_instrumentation, class Lists>
+size_t fixed_k_intersection(const Lists& nums, uint64_t * Match) {
+    switch (nums.size()) {
+        case 0: return 0;
+        case 1: std::copy(nums[0].begin(), nums[0].end(), Match); return nums[0].size();
+        case 2: return fixed_k_intersection<Instrument, 2>(nums, Match);
+        case 3: return fixed_k_intersection<Instrument, 3>(nums, Match);
+        case 4: return fixed_k_intersection<Instrument, 4>(nums, Match);
+        case 5: return fixed_k_intersection<Instrument, 5>(nums, Match);
+        case 6: return fixed_k_intersection<Instrument, 6>(nums, Match);
+        case 7: return fixed_k_intersection<Instrument, 7>(nums, Match);
+        default: break;
+    }
+
+    size_t length = fixed_k_intersection<Instrument, 8>(nums, Match);
+    for (size_t i = 8; i < nums.size(); ++i) {
+        length = scalar_branchless<Instrument>(Match, length, nums[i].data(), nums[i].size(), Match);
+    }
+    return length;
+}
+
+/**
+ * Takes the lists by const reference as nothing is reordered, so it runs as well on
+ * a std::vector<std::span<const uint64_t>> of lists that are not copied.
+ */
+template <typename Instrument = no_instrumentation, class Lists>
+std::vector<uint64_t> using_fixed_k(const Lists& nums) {
+
+    // 1. Check if any index is empty, if so then the intersection is empty
+    if (nums.empty()) {
+        return {};
+    }
+    for (auto& index : nums) {
+        if (index.empty()) {
+            return {};
+        }
+    }
+
+    // 2. No need to sort, all the lists are walked together.
+    // Past 8 lists the kernel only sees the first 8, so only those bound its output.
+    size_t smallest = SIZE_MAX;
+    for (size_t i = 0; i < std::min(nums.size(), size_t{8}); ++i) {
+        smallest = std::min(smallest, nums[i].size());
+    }
+    std::vector<uint64_t> result(smallest);
+    result.resize(fixed_k_intersection<Instrument>(nums, result.data()));
+    return result;
+}
+
+#endif //MULTIPLE_INTERSECTIONS_FIXED_K_INTERSECTION_H
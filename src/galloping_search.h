@@ -17,6 +17,9 @@
 #ifndef MULTIPLE_INTERSECTIONS_GALLOPING_SEARCH_H
 #define MULTIPLE_INTERSECTIONS_GALLOPING_SEARCH_H
 
+#include <algorithm>
+#include "instrumentation.h"
+
 /**
  * This is often called galloping or exponential search.
  *
@@ -28,20 +31,27 @@
  * If none can be found, return array.length.
  * From code by O. Kaser.
  */
+template <typename Instrument = no_instrumentation>
 static size_t frog_advance_until(const uint64_t * array, const size_t pos,
                                  const size_t length, const size_t min) {
     size_t lower = pos + 1;
 
     // special handling for a possibly common sequential case
     if ((lower >= length) or (array[lower] >= min)) {
+        Instrument::comparisons(GALLOPING_KERNEL, 1);
         return lower;
     }
 
     size_t spansize = 1; // could set larger
     // bootstrap an upper limit
 
-    while ((lower + spansize < length) and (array[lower + spansize] < min))
+    size_t gallops = 0;
+    while ((lower + spansize < length) and (array[lower + spansize] < min)) {
         spansize *= 2;
+        ++gallops;
+    }
+    Instrument::gallop_steps(GALLOPING_KERNEL, gallops);
+    Instrument::comparisons(GALLOPING_KERNEL, gallops + 2);
     size_t upper = (lower + spansize < length) ? lower + spansize : length - 1;
 
     // maybe we are lucky (could be common case when the seek ahead expected to be small and sequential will otherwise make us look bad)
@@ -50,6 +60,7 @@ static size_t frog_advance_until(const uint64_t * array, const size_t pos,
     //}
 
     if (array[upper] < min) {// means array has no item >= min
+        Instrument::skipped(GALLOPING_KERNEL, length - pos - 1);
         return length;
     }
 
@@ -58,34 +69,68 @@ static size_t frog_advance_until(const uint64_t * array, const size_t pos,
 
     // else begin binary search
     size_t mid = 0;
+    size_t depth = 0;
     while (lower + 1 != upper) {
         mid = (lower + upper) / 2;
+        ++depth;
         if (array[mid] == min) {
-            return mid;
+            upper = mid;
+            break;
         } else if (array[mid] < min)
             lower = mid;
         else
             upper = mid;
     }
+    Instrument::search_steps(GALLOPING_KERNEL, depth);
+    Instrument::comparisons(GALLOPING_KERNEL, depth);
+    Instrument::skipped(GALLOPING_KERNEL, upper - pos - 1);
     return upper;
 
 }
 
+/**
+ * Like frog_advance_until, but always lands on the first id >= min, a lower bound.
+ * frog_advance_until stops its binary search on any id equal to min, which can be
+ * past the first of them when min repeats in the array.
+ */
+static inline size_t frog_lower_bound(const uint64_t * array, const size_t pos,
+                                      const size_t length, const uint64_t min) {
+    size_t lower = pos + 1;
+    if ((lower >= length) or (array[lower] >= min)) {
+        return lower;
+    }
+
+    size_t spansize = 1;
+    while ((lower + spansize < length) and (array[lower + spansize] < min)) {
+        spansize *= 2;
+    }
+
+    // array[lower + spansize / 2] < min, and array[lower + spansize] >= min if it exists
+    const uint64_t * first = array + lower + spansize / 2 + 1;
+    const uint64_t * last = array + std::min(lower + spansize, length);
+    return static_cast<size_t>(std::lower_bound(first, last, min) - array);
+}
+
+template <typename Instrument = no_instrumentation>
 size_t onesided_galloping_intersection(const uint64_t * smallset,
                                      const size_t smalllength, const uint64_t * largeset,
                                      const size_t largelength, uint64_t * out) {
-    if(largelength < smalllength) return onesided_galloping_intersection(largeset, largelength, smallset, smalllength, out);
+    if(largelength < smalllength) return onesided_galloping_intersection<Instrument>(largeset, largelength, smallset, smalllength, out);
+    typename Instrument::timer timer(GALLOPING_KERNEL);
     if (0 == smalllength)
         return 0;
     const uint64_t * const initout(out);
     size_t k1 = 0, k2 = 0;
+    size_t compares = 0;
     while (true) {
+        ++compares;
         if (largeset[k1] < smallset[k2]) {
-            k1 = frog_advance_until(largeset, k1, largelength, smallset[k2]);
+            k1 = frog_advance_until<Instrument>(largeset, k1, largelength, smallset[k2]);
             if (k1 == largelength)
                 break;
         }
-        midpoint: if (smallset[k2] < largeset[k1]) {
+        midpoint: ++compares;
+        if (smallset[k2] < largeset[k1]) {
         ++k2;
         if (k2 == smalllength)
             break;
@@ -94,16 +139,19 @@ size_t onesided_galloping_intersection(const uint64_t * smallset,
         ++k2;
         if (k2 == smalllength)
             break;
-        k1 = frog_advance_until(largeset, k1, largelength, smallset[k2]);
+        k1 = frog_advance_until<Instrument>(largeset, k1, largelength, smallset[k2]);
         if (k1 == largelength)
             break;
         goto midpoint;
     }
     }
+    Instrument::comparisons(GALLOPING_KERNEL, compares);
+    Instrument::output(GALLOPING_KERNEL, static_cast<uint64_t>(out - initout));
     return out - initout;
 
 }
 
+template <typename Instrument = no_instrumentation>
 std::vector<uint64_t> using_galloping_search(std::vector<std::vector<uint64_t>>& nums) {
 
     // 1. Check if any index is empty, if so then the intersection is empty
@@ -126,7 +174,7 @@ std::vector<uint64_t> using_galloping_search(std::vector<std::vector<uint64_t>>&
         // here we can change the intersection function to any regular scalar
         // or vector pair-set intersection algorithms.
         size_t inter_length =
-                onesided_galloping_intersection(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
+                onesided_galloping_intersection<Instrument>(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
         result.resize(inter_length);
     }
     return result;
@@ -18,17 +18,38 @@
 #define MULTIPLE_INTERSECTIONS_GENERATE_DATA_H
 
 #include <random>
+#include <string>
+#include <filesystem>
+#include <unordered_map>
 #include <set>
 #include <vector>
 #include <algorithm>
+#include "sketches.h"
+#include "block_index.h"
+#include "streaming_intersection.h"
 
 // Generate the Data
 std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<std::vector<uint64_t>>>> sorted_maps;
 std::vector<std::vector<uint64_t>> sorted_vectors;
 
-std::vector<uint64_t> generate_sorted_data(uint64_t count, uint64_t size) {
-    auto randomNumberBetween = [](uint64_t low, uint64_t high) {
-        auto randomFunc = [distribution_ = std::uniform_int_distribution<uint64_t>(low, high),
+// Lists where the ids come in tight clusters, like friends from the same school or company
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<std::vector<uint64_t>>>> clustered_maps;
+
+// Block indexes over the lists above, each pointing into its list
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<block_indexed_list>>> block_index_maps;
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<block_indexed_list>>> clustered_block_index_maps;
+
+// Pools of queries where most intersections are empty, and the sketches of their lists
+const size_t SPARSE_QUERIES = 16;
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<std::vector<std::vector<uint64_t>>>>> sparse_query_maps;
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<std::vector<list_sketch>>>> sparse_sketch_maps;
+
+// Lists written out to files for the streaming intersection
+std::unordered_map<uint64_t, std::unordered_map<uint64_t, std::vector<std::string>>> file_maps;
+
+std::vector<uint64_t> generate_sorted_data_up_to(uint64_t size, uint64_t high) {
+    auto randomNumberBetween = [](uint64_t from, uint64_t to) {
+        auto randomFunc = [distribution_ = std::uniform_int_distribution<uint64_t>(from, to),
                 random_engine_ = std::mt19937{ std::random_device{}() }]() mutable {
             return distribution_(random_engine_);
         };
@@ -36,7 +57,29 @@ std::vector<uint64_t> generate_sorted_data(uint64_t count, uint64_t size) {
     };
 
     std::vector<uint64_t> data;
-    std::generate_n(std::back_inserter(data), size, randomNumberBetween(1, size * 20 / count));
+    std::generate_n(std::back_inserter(data), size, randomNumberBetween(1, high));
+
+    std::ranges::sort(data);
+    return data;
+}
+
+std::vector<uint64_t> generate_sorted_data(uint64_t count, uint64_t size) {
+    return generate_sorted_data_up_to(size, size * 20 / count);
+}
+
+// Clusters of up to 128 ids within a span of 512, placed at random over a universe 64 times the size
+std::vector<uint64_t> generate_clustered_data(uint64_t size) {
+    std::mt19937 random_engine{ std::random_device{}() };
+    std::uniform_int_distribution<uint64_t> cluster_start(1, size * 64);
+    std::uniform_int_distribution<uint64_t> cluster_offset(0, 511);
+
+    std::vector<uint64_t> data;
+    while (data.size() < size) {
+        uint64_t start = cluster_start(random_engine);
+        for (size_t i = 0; i < 128 && data.size() < size; i++) {
+            data.push_back(start + cluster_offset(random_engine));
+        }
+    }
 
     std::ranges::sort(data);
     return data;
@@ -51,9 +94,77 @@ void load_data(const benchmark::State& state) {
         vectors.emplace_back(generate_sorted_data(count, size));
     }
     sorted_maps[count][size] = vectors;
+    block_index_maps[count][size] = build_block_index(sorted_maps[count][size]);
 
     // Setup/Teardown should never be called with any thread_idx != 0.
     assert(state.thread_index() == 0);
 }
 
+void load_clustered_data(const benchmark::State& state) {
+    auto count = state.range(0);
+    auto size = state.range(1);
+
+    std::vector<std::vector<uint64_t>> vectors;
+    for (auto i = 0; i < count; i++) {
+        vectors.emplace_back(generate_clustered_data(size));
+    }
+    clustered_maps[count][size] = vectors;
+    clustered_block_index_maps[count][size] = build_block_index(clustered_maps[count][size]);
+
+    assert(state.thread_index() == 0);
+}
+
+void load_sparse_data(const benchmark::State& state) {
+    auto count = state.range(0);
+    auto size = state.range(1);
+
+    // ids are spread over a universe 1024 times the list size, so small lists rarely share any
+    std::vector<std::vector<std::vector<uint64_t>>> queries;
+    std::vector<std::vector<list_sketch>> sketches;
+    for (size_t query = 0; query < SPARSE_QUERIES; query++) {
+        std::vector<std::vector<uint64_t>> vectors;
+        for (auto i = 0; i < count; i++) {
+            vectors.emplace_back(generate_sorted_data_up_to(size, size * 1024));
+        }
+        sketches.emplace_back(build_sketches(vectors));
+        queries.emplace_back(vectors);
+    }
+    sparse_query_maps[count][size] = queries;
+    sparse_sketch_maps[count][size] = sketches;
+
+    assert(state.thread_index() == 0);
+}
+
+// The pools are up to 16 times the size of the other data sets, so they only live as long as their benchmark
+void remove_sparse_data(const benchmark::State& state) {
+    sparse_query_maps[state.range(0)].erase(state.range(1));
+    sparse_sketch_maps[state.range(0)].erase(state.range(1));
+}
+
+void load_file_data(const benchmark::State& state) {
+    auto count = state.range(0);
+    auto size = state.range(1);
+
+    std::vector<std::string> paths;
+    for (auto i = 0; i < count; i++) {
+        // the streaming intersection works on sets, so repeated ids are dropped
+        auto data = generate_sorted_data(count, size);
+        data.erase(std::unique(data.begin(), data.end()), data.end());
+        auto path = std::filesystem::temp_directory_path() /
+                ("multiple_intersections_" + std::to_string(count) + "_" + std::to_string(size) + "_" + std::to_string(i) + ".ids");
+        write_sorted_list(path.string(), data);
+        paths.emplace_back(path.string());
+    }
+    file_maps[count][size] = paths;
+
+    assert(state.thread_index() == 0);
+}
+
+void remove_file_data(const benchmark::State& state) {
+    for (auto& path : file_maps[state.range(0)][state.range(1)]) {
+        std::filesystem::remove(path);
+        std::filesystem::remove(path + ".idx");
+    }
+}
+
 #endif //MULTIPLE_INTERSECTIONS_GENERATE_DATA_H
@@ -0,0 +1,313 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_INSTRUMENTATION_H
+#define MULTIPLE_INTERSECTIONS_INSTRUMENTATION_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+enum kernel_id : size_t {
+    GALLOPING_KERNEL,
+    BINARY_SEARCH_KERNEL,
+    BRANCHLESS_KERNEL,
+    BRANCHLESS_UNROLLED_KERNEL,
+    BLOCK_SKIPPING_KERNEL,
+    FIXED_K_KERNEL,
+    INTERSECTION_VIEW_KERNEL,
+    BRANCHLESS_DIFFERENCE_KERNEL,
+    GALLOPING_DIFFERENCE_KERNEL,
+    BRANCHLESS_UNION_KERNEL,
+    BRANCHLESS_SYMMETRIC_DIFFERENCE_KERNEL,
+    HEAP_UNION_KERNEL,
+    KERNEL_COUNT
+};
+
+static const char * const kernel_names[KERNEL_COUNT] = {
+        "onesided_galloping_intersection",
+        "binary_search_intersection",
+        "scalar_branchless",
+        "scalar_branchless_unrolled",
+        "block_skipping_intersection",
+        "fixed_k_intersection",
+        "intersection_view",
+        "scalar_branchless_difference",
+        "onesided_galloping_difference",
+        "scalar_branchless_union",
+        "scalar_branchless_symmetric_difference",
+        "heap_union"
+};
+
+// 16 sub buckets per power of two keeps every bucket within about 6% of its values
+const size_t LATENCY_SUB_BUCKET_BITS = 4;
+const size_t LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+const size_t LATENCY_BUCKETS = (64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+/**
+ * Log linear (HDR style) bucket of a value: exact below 16, then 16 buckets
+ * for every power of two.
+ */
+static inline size_t latency_bucket(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return value;
+    }
+    size_t msb = static_cast<size_t>(63 - std::countl_zero(value));
+    size_t mantissa = (value >> (msb - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+    return (msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + mantissa;
+}
+
+// Smallest value that lands in the bucket
+static inline uint64_t latency_bucket_value(size_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t msb = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    uint64_t mantissa = bucket % LATENCY_SUB_BUCKETS;
+    return (LATENCY_SUB_BUCKETS + mantissa) << (msb - LATENCY_SUB_BUCKET_BITS);
+}
+
+/**
+ * Plain copy of a histogram, safe to merge, query and print.
+ */
+struct histogram_snapshot {
+    std::array<uint64_t, LATENCY_BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    void merge(const histogram_snapshot& other) {
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        max = std::max(max, other.max);
+    }
+
+    // Value at a percentile between 0 and 100, to within the bucket width
+    uint64_t percentile(double percent) const {
+        if (total == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(percent / 100.0 * static_cast<double>(total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::min(latency_bucket_value(i), max);
+            }
+        }
+        return max;
+    }
+};
+
+/**
+ * Histogram written by a single thread and read by any.
+ * Recording is a relaxed load and store, no locks and no atomic read-modify-write.
+ */
+class latency_histogram {
+public:
+    void record(uint64_t value) {
+        bump(counts_[latency_bucket(value)], 1);
+        bump(total_, 1);
+        if (value > max_.load(std::memory_order_relaxed)) {
+            max_.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    histogram_snapshot snapshot() const {
+        histogram_snapshot copy;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            copy.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+        copy.total = total_.load(std::memory_order_relaxed);
+        copy.max = max_.load(std::memory_order_relaxed);
+        return copy;
+    }
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> counts_{};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+struct kernel_counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> comparisons{0};
+    std::atomic<uint64_t> skipped{0};        // ids jumped over without being compared one by one
+    std::atomic<uint64_t> gallop_steps{0};   // doublings of the galloping span
+    std::atomic<uint64_t> search_steps{0};   // binary search iterations, the search depth
+    std::atomic<uint64_t> output{0};
+    latency_histogram latency;               // nanoseconds per call
+};
+
+struct kernel_snapshot {
+    uint64_t calls = 0;
+    uint64_t comparisons = 0;
+    uint64_t skipped = 0;
+    uint64_t gallop_steps = 0;
+    uint64_t search_steps = 0;
+    uint64_t output = 0;
+    histogram_snapshot latency;
+};
+
+using instrumentation_snapshot = std::array<kernel_snapshot, KERNEL_COUNT>;
+
+/**
+ * Every thread that runs an instrumented kernel registers its counters here once.
+ * They are never freed, so a snapshot still sees threads that have exited.
+ */
+class instrumentation_registry {
+public:
+    static instrumentation_registry& instance() {
+        static instrumentation_registry registry;
+        return registry;
+    }
+
+    static std::array<kernel_counters, KERNEL_COUNT>& local() {
+        // constant initialized, so reaching it does not go through a thread_local init guard
+        thread_local std::array<kernel_counters, KERNEL_COUNT> * counters = nullptr;
+        if (counters == nullptr) {
+            counters = instance().add();
+        }
+        return *counters;
+    }
+
+    instrumentation_snapshot snapshot() {
+        instrumentation_snapshot totals;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& thread : threads_) {
+            for (size_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+                auto& from = (*thread)[kernel];
+                auto& to = totals[kernel];
+                to.calls += from.calls.load(std::memory_order_relaxed);
+                to.comparisons += from.comparisons.load(std::memory_order_relaxed);
+                to.skipped += from.skipped.load(std::memory_order_relaxed);
+                to.gallop_steps += from.gallop_steps.load(std::memory_order_relaxed);
+                to.search_steps += from.search_steps.load(std::memory_order_relaxed);
+                to.output += from.output.load(std::memory_order_relaxed);
+                to.latency.merge(from.latency.snapshot());
+            }
+        }
+        return totals;
+    }
+
+private:
+    std::array<kernel_counters, KERNEL_COUNT> * add() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.emplace_back(std::make_unique<std::array<kernel_counters, KERNEL_COUNT>>());
+        return threads_.back().get();
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<std::array<kernel_counters, KERNEL_COUNT>>> threads_;
+};
+
+/**
+ * Default policy of the kernels: every hook is empty and compiles away.
+ */
+struct no_instrumentation {
+    static void comparisons(kernel_id, uint64_t) {}
+    static void skipped(kernel_id, uint64_t) {}
+    static void gallop_steps(kernel_id, uint64_t) {}
+    static void search_steps(kernel_id, uint64_t) {}
+    static void output(kernel_id, uint64_t) {}
+
+    struct timer {
+        explicit timer(kernel_id) {}
+    };
+};
+
+/**
+ * Policy that counts into the per thread counters of the registry,
+ * and times every kernel call into its latency histogram.
+ */
+struct thread_instrumentation {
+    static void comparisons(kernel_id kernel, uint64_t count) {
+        latency_histogram::bump(instrumentation_registry::local()[kernel].comparisons, count);
+    }
+    static void skipped(kernel_id kernel, uint64_t count) {
+        latency_histogram::bump(instrumentation_registry::local()[kernel].skipped, count);
+    }
+    static void gallop_steps(kernel_id kernel, uint64_t count) {
+        latency_histogram::bump(instrumentation_registry::local()[kernel].gallop_steps, count);
+    }
+    static void search_steps(kernel_id kernel, uint64_t count) {
+        latency_histogram::bump(instrumentation_registry::local()[kernel].search_steps, count);
+    }
+    static void output(kernel_id kernel, uint64_t count) {
+        latency_histogram::bump(instrumentation_registry::local()[kernel].output, count);
+    }
+
+    class timer {
+    public:
+        explicit timer(kernel_id kernel) : kernel_(kernel), start_(std::chrono::steady_clock::now()) {}
+
+        ~timer() {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            auto& counters = instrumentation_registry::local()[kernel_];
+            latency_histogram::bump(counters.calls, 1);
+            counters.latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+
+        timer(const timer&) = delete;
+        timer& operator=(const timer&) = delete;
+
+    private:
+        kernel_id kernel_;
+        std::chrono::steady_clock::time_point start_;
+    };
+};
+
+instrumentation_snapshot snapshot_instrumentation() {
+    return instrumentation_registry::instance().snapshot();
+}
+
+void dump_instrumentation(std::ostream& out, const instrumentation_snapshot& snapshot) {
+    for (size_t kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+        auto& counters = snapshot[kernel];
+        if (counters.calls == 0) {
+            continue;
+        }
+        out << kernel_names[kernel]
+            << " calls=" << counters.calls
+            << " comparisons=" << counters.comparisons
+            << " skipped=" << counters.skipped
+            << " gallop_steps=" << counters.gallop_steps
+            << " search_steps=" << counters.search_steps
+            << " output=" << counters.output
+            << " p50_ns=" << counters.latency.percentile(50)
+            << " p90_ns=" << counters.latency.percentile(90)
+            << " p99_ns=" << counters.latency.percentile(99)
+            << " max_ns=" << counters.latency.max << "\n";
+    }
+}
+
+void dump_instrumentation(std::ostream& out) {
+    dump_instrumentation(out, snapshot_instrumentation());
+}
+
+#endif //MULTIPLE_INTERSECTIONS_INSTRUMENTATION_H
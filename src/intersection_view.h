@@ -0,0 +1,280 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_INTERSECTION_VIEW_H
+#define MULTIPLE_INTERSECTIONS_INTERSECTION_VIEW_H
+
+#include <span>
+#include <ranges>
+#include <vector>
+#include <algorithm>
+#include "galloping_search.h"
+#include "instrumentation.h"
+
+/**
+ * First id >= min at or after pos, galloping. Unlike frog_advance_until the id
+ * at pos itself counts, and repeats of min are never skipped.
+ */
+static size_t gallop_to(const uint64_t * array, const size_t pos,
+                        const size_t length, const uint64_t min) {
+    if (pos >= length or array[pos] >= min) {
+        return pos;
+    }
+    return frog_lower_bound(array, pos, length, min);
+}
+
+/**
+ * Lazy k-way intersection, usable in range-for and std::ranges pipelines.
+ *
+ * Matches are found one at a time on demand with a leapfrog over the lists:
+ * each list gallops to the highest id seen so far until all of them agree.
+ * The only state is one cursor per list, and no work is done past the
+ * last id the consumer asked for.
+ *
+ * It is an input range: the cursors live in the view, so begin() can only
+ * be walked once. The lists must outlive the view.
+ * Instrumented, every gallop counts as a comparison and the ids it jumps as skipped.
+ * A view has no single call to time, so the timer is left to its drivers.
+ */
+template <typename Instrument = no_instrumentation>
+class intersection_view : public std::ranges::view_interface<intersection_view<Instrument>> {
+public:
+    class iterator {
+    public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = uint64_t;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(intersection_view * parent) : parent_(parent) {}
+
+        uint64_t operator*() const { return parent_->current_; }
+
+        iterator& operator++() {
+            parent_->next();
+            return *this;
+        }
+
+        void operator++(int) { parent_->next(); }
+
+        friend bool operator==(const iterator& it, std::default_sentinel_t) { return it.at_end(); }
+
+    private:
+        bool at_end() const { return parent_->done_; }
+
+        intersection_view * parent_ = nullptr;
+    };
+
+    intersection_view() = default;
+
+    explicit intersection_view(std::vector<std::span<const uint64_t>> lists) : lists_(std::move(lists)),
+                                                                               positions_(lists_.size(), 0) {
+        // leading with the smallest list makes the first guesses the most selective
+        std::sort(lists_.begin(), lists_.end(), [](auto& left, auto& right) { return left.size() < right.size(); });
+    }
+
+    explicit intersection_view(const std::vector<std::vector<uint64_t>>& nums) :
+            intersection_view(std::vector<std::span<const uint64_t>>(nums.begin(), nums.end())) {}
+
+    iterator begin() {
+        std::fill(positions_.begin(), positions_.end(), 0);
+        done_ = lists_.empty();
+        find_match();
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    // Every list consumes one copy of the id that matched, like the pairwise merges do,
+    // so an id repeated in every list comes out as often as its fewest repeats
+    void next() {
+        for (size_t i = 0; i < lists_.size(); ++i) {
+            ++positions_[i];
+        }
+        find_match();
+    }
+
+    void find_match() {
+        if (done_) {
+            return;
+        }
+        if (positions_[0] >= lists_[0].size()) {
+            done_ = true;
+            return;
+        }
+        uint64_t target = lists_[0][positions_[0]];
+        size_t agree = 1;
+        size_t i = 0;
+        while (agree < lists_.size()) {
+            if (++i == lists_.size()) {
+                i = 0;
+            }
+            auto& list = lists_[i];
+            size_t from = positions_[i];
+            positions_[i] = gallop_to(list.data(), positions_[i], list.size(), target);
+            Instrument::comparisons(INTERSECTION_VIEW_KERNEL, 1);
+            Instrument::skipped(INTERSECTION_VIEW_KERNEL, positions_[i] - from);
+            if (positions_[i] == list.size()) {
+                done_ = true;
+                return;
+            }
+            if (list[positions_[i]] == target) {
+                ++agree;
+            } else {
+                target = list[positions_[i]];
+                agree = 1;
+            }
+        }
+        current_ = target;
+        Instrument::output(INTERSECTION_VIEW_KERNEL, 1);
+    }
+
+    std::vector<std::span<const uint64_t>> lists_;
+    std::vector<size_t> positions_;
+    uint64_t current_ = 0;
+    bool done_ = true;
+};
+
+/**
+ * Lazily intersects any sorted input view of ids with one more sorted list,
+ * galloping through the list. Built by the intersect_with adaptor below, so
+ * intersections can be stacked on top of filters or other intersections
+ * without building temporaries.
+ */
+template <std::ranges::input_range V>
+requires std::ranges::view<V>
+class intersect_with_view : public std::ranges::view_interface<intersect_with_view<V>> {
+public:
+    class iterator {
+    public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = uint64_t;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(intersect_with_view * parent) : parent_(parent) {}
+
+        uint64_t operator*() const { return parent_->list_[parent_->position_]; }
+
+        iterator& operator++() {
+            parent_->next();
+            return *this;
+        }
+
+        void operator++(int) { parent_->next(); }
+
+        friend bool operator==(const iterator& it, std::default_sentinel_t) { return it.at_end(); }
+
+    private:
+        bool at_end() const { return parent_->done_; }
+
+        intersect_with_view * parent_ = nullptr;
+    };
+
+    intersect_with_view() = default;
+
+    intersect_with_view(V base, std::span<const uint64_t> list) : base_(std::move(base)), list_(list) {}
+
+    iterator begin() {
+        current_ = std::ranges::begin(base_);
+        position_ = 0;
+        done_ = false;
+        find_match();
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    void next() {
+        ++position_;
+        ++current_;
+        find_match();
+    }
+
+    void find_match() {
+        for (; current_ != std::ranges::end(base_); ++current_) {
+            uint64_t target = *current_;
+            position_ = gallop_to(list_.data(), position_, list_.size(), target);
+            if (position_ == list_.size()) {
+                break;
+            }
+            if (list_[position_] == target) {
+                return;
+            }
+        }
+        done_ = true;
+    }
+
+    V base_;
+    std::span<const uint64_t> list_;
+    std::ranges::iterator_t<V> current_;
+    size_t position_ = 0;
+    bool done_ = true;
+};
+
+template <class R>
+intersect_with_view(R&&, std::span<const uint64_t>) -> intersect_with_view<std::views::all_t<R>>;
+
+struct intersect_with {
+    std::span<const uint64_t> list;
+
+    explicit intersect_with(std::span<const uint64_t> with) : list(with) {}
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R&& range, intersect_with adaptor) {
+        return intersect_with_view(std::views::all(std::forward<R>(range)), adaptor.list);
+    }
+};
+
+template <typename Instrument = no_instrumentation>
+std::vector<uint64_t> using_intersection_view(std::vector<std::vector<uint64_t>>& nums) {
+    typename Instrument::timer timer(INTERSECTION_VIEW_KERNEL);
+    std::vector<uint64_t> result;
+    for (auto id : intersection_view<Instrument>(nums)) {
+        result.push_back(id);
+    }
+    return result;
+}
+
+/**
+ * Views of lists owned elsewhere, like the neighbour lists of a graph, are read where they are.
+ */
+template <typename Instrument = no_instrumentation>
+std::vector<uint64_t> using_intersection_view(const std::vector<std::span<const uint64_t>>& lists) {
+    typename Instrument::timer timer(INTERSECTION_VIEW_KERNEL);
+    std::vector<uint64_t> result;
+    for (auto id : intersection_view<Instrument>(lists)) {
+        result.push_back(id);
+    }
+    return result;
+}
+
+/**
+ * Pagination: only the first `limit` common ids are ever computed.
+ */
+template <typename Instrument = no_instrumentation>
+std::vector<uint64_t> using_intersection_view_first(std::vector<std::vector<uint64_t>>& nums, size_t limit) {
+    typename Instrument::timer timer(INTERSECTION_VIEW_KERNEL);
+    std::vector<uint64_t> result;
+    for (auto id : intersection_view<Instrument>(nums) | std::views::take(limit)) {
+        result.push_back(id);
+    }
+    return result;
+}
+
+#endif //MULTIPLE_INTERSECTIONS_INTERSECTION_VIEW_H
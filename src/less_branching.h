@@ -20,14 +20,29 @@
 #include <set>
 #include <vector>
 #include <algorithm>
+#include "instrumentation.h"
+
+/**
+ * Merges only ever step, so the comparisons are counted after the fact:
+ * every step moved A, B or both (on a match).
+ */
+template <typename Instrument>
+static void count_merge_steps(kernel_id kernel, size_t advancedA, size_t advancedB, size_t matches) {
+    Instrument::comparisons(kernel, advancedA + advancedB - matches);
+    Instrument::output(kernel, matches);
+}
 
 /**
  * Branchless approach by N. Kurz.
  */
+template <typename Instrument = no_instrumentation>
 size_t scalar_branchless(const uint64_t *A, size_t lenA,
                          const uint64_t *B, size_t lenB,
                          uint64_t *Match) {
 
+    typename Instrument::timer timer(BRANCHLESS_KERNEL);
+    const uint64_t *initA = A;
+    const uint64_t *initB = B;
     const uint64_t *initMatch = Match;
     const uint64_t *endA = A + lenA;
     const uint64_t *endB = B + lenB;
@@ -44,6 +59,7 @@ size_t scalar_branchless(const uint64_t *A, size_t lenA,
     }
 
     size_t count = Match - initMatch;
+    count_merge_steps<Instrument>(BRANCHLESS_KERNEL, A - initA, B - initB, count);
     return count;
 }
 
@@ -62,12 +78,16 @@ size_t scalar_branchless(const uint64_t *A, size_t lenA,
 /**
  * Unrolled branchless approach by N. Kurz.
  */
+template <typename Instrument = no_instrumentation>
 size_t scalar_branchless_unrolled(const uint64_t *A, size_t lenA,
                                   const uint64_t *B, size_t lenB,
                                   uint64_t *Match) {
 
     const size_t UNROLLED = 4;
 
+    typename Instrument::timer timer(BRANCHLESS_UNROLLED_KERNEL);
+    const uint64_t *initA = A;
+    const uint64_t *initB = B;
     const uint64_t *initMatch = Match;
     const uint64_t *endA = A + lenA;
     const uint64_t *endB = B + lenB;
@@ -90,11 +110,13 @@ size_t scalar_branchless_unrolled(const uint64_t *A, size_t lenA,
     }
 
     size_t count = Match - initMatch;
+    count_merge_steps<Instrument>(BRANCHLESS_UNROLLED_KERNEL, A - initA, B - initB, count);
     return count;
 }
 
 #undef BRANCHLESSMATCH
 
+template <typename Instrument = no_instrumentation>
 std::vector<uint64_t> using_less_branching(std::vector<std::vector<uint64_t>>& nums) {
 
     // 1. Check if any index is empty, if so then the intersection is empty
@@ -117,12 +139,13 @@ std::vector<uint64_t> using_less_branching(std::vector<std::vector<uint64_t>>& n
         // here we can change the intersection function to any regular scalar
         // or vector pair-set intersection algorithms.
         size_t inter_length =
-                scalar_branchless(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
+                scalar_branchless<Instrument>(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
         result.resize(inter_length);
     }
     return result;
 }
 
+template <typename Instrument = no_instrumentation>
 std::vector<uint64_t> using_less_branching_unrolled(std::vector<std::vector<uint64_t>>& nums) {
 
     // 1. Check if any index is empty, if so then the intersection is empty
@@ -145,7 +168,7 @@ std::vector<uint64_t> using_less_branching_unrolled(std::vector<std::vector<uint
         // here we can change the intersection function to any regular scalar
         // or vector pair-set intersection algorithms.
         size_t inter_length =
-                scalar_branchless_unrolled(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
+                scalar_branchless_unrolled<Instrument>(result.data(), result.size(), nums[i].data(), nums[i].size(), result.data());
         result.resize(inter_length);
     }
     return result;
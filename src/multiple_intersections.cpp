@@ -20,6 +20,12 @@
 #include "galloping_search.h"
 #include "binary_search.h"
 #include "less_branching.h"
+#include "sketches.h"
+#include "block_index.h"
+#include "intersection_view.h"
+#include "fixed_k_intersection.h"
+#include "set_operations.h"
+#include "streaming_intersection.h"
 
 static void BM_using_ranges_set_intersection(benchmark::State &state) {
     sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
@@ -63,6 +69,196 @@ static void BM_using_less_branching_unrolled(benchmark::State &state) {
     }
 }
 
+static void BM_using_block_index(benchmark::State &state) {
+    auto lists = block_index_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_block_index(lists));
+    }
+}
+
+static void BM_using_galloping_search_clustered(benchmark::State &state) {
+    sorted_vectors = clustered_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_galloping_search(sorted_vectors));
+    }
+}
+
+static void BM_using_less_branching_unrolled_clustered(benchmark::State &state) {
+    sorted_vectors = clustered_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_less_branching_unrolled(sorted_vectors));
+    }
+}
+
+static void BM_using_block_index_clustered(benchmark::State &state) {
+    auto lists = clustered_block_index_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_block_index(lists));
+    }
+}
+
+static void BM_using_intersection_view(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_intersection_view(sorted_vectors));
+    }
+}
+
+// first page of 20 mutual friends, compare with the full materialization above
+static void BM_using_intersection_view_first_20(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_intersection_view_first(sorted_vectors, 20));
+    }
+}
+
+static void BM_using_fixed_k(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_fixed_k(sorted_vectors));
+    }
+}
+
+static void BM_using_std_set_difference(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_std_set_difference(sorted_vectors));
+    }
+}
+
+static void BM_using_less_branching_difference(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_less_branching_difference(sorted_vectors));
+    }
+}
+
+static void BM_using_galloping_difference(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_galloping_difference(sorted_vectors));
+    }
+}
+
+static void BM_using_less_branching_symmetric_difference(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_less_branching_symmetric_difference(sorted_vectors));
+    }
+}
+
+static void BM_using_std_set_union(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_std_set_union(sorted_vectors));
+    }
+}
+
+static void BM_using_less_branching_union(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_less_branching_union(sorted_vectors));
+    }
+}
+
+static void BM_using_heap_union(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_heap_union(sorted_vectors));
+    }
+}
+
+// same as above with the counters and latency histograms on, to see what they cost
+static void BM_using_galloping_search_instrumented(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_galloping_search<thread_instrumentation>(sorted_vectors));
+    }
+}
+
+static void BM_using_less_branching_instrumented(benchmark::State &state) {
+    sorted_vectors = sorted_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(using_less_branching<thread_instrumentation>(sorted_vectors));
+    }
+}
+
+static void BM_using_galloping_search_sparse(benchmark::State &state) {
+    auto& queries = sparse_query_maps[state.range(0)][state.range(1)];
+    size_t query = 0;
+    size_t empty = 0;
+    for (auto _ : state) {
+        auto result = using_galloping_search(queries[query]);
+        empty += result.empty() ? 1 : 0;
+        benchmark::DoNotOptimize(result);
+        query = (query + 1) % queries.size();
+    }
+    state.counters["empty"] = benchmark::Counter(static_cast<double>(empty), benchmark::Counter::kAvgIterations);
+}
+
+static void BM_using_sketches_sparse(benchmark::State &state) {
+    auto& queries = sparse_query_maps[state.range(0)][state.range(1)];
+    auto& sketches = sparse_sketch_maps[state.range(0)][state.range(1)];
+    size_t query = 0;
+    size_t empty = 0;
+    size_t rejected = 0;
+    for (auto _ : state) {
+        bool disjoint = sketches_disjoint(sketches[query]);
+        auto result = disjoint ? std::vector<uint64_t>() : using_galloping_search(queries[query]);
+        rejected += disjoint ? 1 : 0;
+        empty += result.empty() ? 1 : 0;
+        benchmark::DoNotOptimize(result);
+        query = (query + 1) % queries.size();
+    }
+    // rejected / empty is the share of the empty answers the sketches caught without touching the lists
+    state.counters["empty"] = benchmark::Counter(static_cast<double>(empty), benchmark::Counter::kAvgIterations);
+    state.counters["rejected"] = benchmark::Counter(static_cast<double>(rejected), benchmark::Counter::kAvgIterations);
+}
+
+static void BM_estimate_intersection_size_sparse(benchmark::State &state) {
+    auto& sketches = sparse_sketch_maps[state.range(0)][state.range(1)];
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(estimate_intersection_size(sketches[query]));
+        query = (query + 1) % sketches.size();
+    }
+}
+
+static int64_t file_bytes(const std::vector<std::string>& paths) {
+    int64_t bytes = 0;
+    for (auto& path : paths) {
+        bytes += static_cast<int64_t>(std::filesystem::file_size(path));
+    }
+    return bytes;
+}
+
+// Reads every chunk of every list and nothing else, the ceiling for the streaming intersection
+static void BM_sequential_read(benchmark::State &state) {
+    auto& paths = file_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        uint64_t sum = 0;
+        for (auto& path : paths) {
+            chunked_list_reader reader(path);
+            for (size_t chunk = 0; chunk < reader.chunks(); ++chunk) {
+                sum += reader.load(chunk).back();
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed(state.iterations() * file_bytes(paths));
+}
+
+static void BM_using_streaming_intersection(benchmark::State &state) {
+    auto& paths = file_maps[state.range(0)][state.range(1)];
+    for (auto _ : state) {
+        size_t matches = streaming_intersection(paths, [](const uint64_t * ids, size_t) {
+            benchmark::DoNotOptimize(ids);
+        });
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetBytesProcessed(state.iterations() * file_bytes(paths));
+}
+
 BENCHMARK(BM_using_ranges_set_intersection)
     ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
                    benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
@@ -93,4 +289,116 @@ BENCHMARK(BM_using_less_branching_unrolled)
                        benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
         ->Setup(load_data);
 
+BENCHMARK(BM_using_block_index)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_galloping_search_clustered)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_clustered_data);
+
+BENCHMARK(BM_using_less_branching_unrolled_clustered)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_clustered_data);
+
+BENCHMARK(BM_using_block_index_clustered)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_clustered_data);
+
+BENCHMARK(BM_using_intersection_view)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_intersection_view_first_20)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_fixed_k)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_std_set_difference)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_less_branching_difference)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_galloping_difference)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_less_branching_symmetric_difference)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_std_set_union)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_less_branching_union)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_heap_union)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_galloping_search_instrumented)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_less_branching_instrumented)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_data);
+
+BENCHMARK(BM_using_galloping_search_sparse)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_sparse_data)
+        ->Teardown(remove_sparse_data);
+
+BENCHMARK(BM_using_sketches_sparse)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_sparse_data)
+        ->Teardown(remove_sparse_data);
+
+BENCHMARK(BM_estimate_intersection_size_sparse)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->Setup(load_sparse_data)
+        ->Teardown(remove_sparse_data);
+
+BENCHMARK(BM_sequential_read)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->UseRealTime()
+        ->Setup(load_file_data)
+        ->Teardown(remove_file_data);
+
+BENCHMARK(BM_using_streaming_intersection)
+        ->ArgsProduct({benchmark::CreateDenseRange(2, 7, /*step=*/ 1),
+                       benchmark::CreateRange(8, 262144, /*multi=*/ 8)})
+        ->UseRealTime()
+        ->Setup(load_file_data)
+        ->Teardown(remove_file_data);
+
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,278 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_SKETCHES_H
+#define MULTIPLE_INTERSECTIONS_SKETCHES_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "galloping_search.h"
+
+// Bloom filter bits per id, rounded up to a power of two words so filters of different sizes can be folded together
+const size_t SKETCH_BLOOM_BITS_PER_ID = 16;
+// 64 words = 4096 bits = 512 bytes for the smallest lists, 65536 words = 512KB for the largest
+const size_t SKETCH_BLOOM_MIN_WORDS = 64;
+const size_t SKETCH_BLOOM_MAX_WORDS = 65536;
+// Past this share of bits set (about 6.7M ids at the cap) a bloom answer is mostly noise, so the filter is dropped
+const double SKETCH_BLOOM_MAX_FILL = 0.8;
+// The k of the KMV sample: the smallest 4096 hashes, 32KB whatever the size of the list
+const size_t SKETCH_SAMPLE_SIZE = 4096;
+
+/**
+ * Small summary of one sorted list, built once alongside the data.
+ *
+ * min / max reject lists that do not overlap in value space.
+ * The bloom filter uses a single hash per id, so if the AND of the filters of
+ * all the lists is empty no id can be in all of them. It is sized to the list,
+ * a fixed size filter fills up and stops rejecting past a few thousand ids,
+ * and it is dropped when the list is too large for it even at the cap.
+ * The sample keeps the SKETCH_SAMPLE_SIZE smallest hashes of the distinct ids (every
+ * hash up to threshold) and gives us distinct count and intersection estimates.
+ */
+struct list_sketch {
+    uint64_t min = 0;
+    uint64_t max = 0;
+    std::vector<uint64_t> bloom;       // a power of two words, empty when dropped
+    double bloom_fill = 0;             // share of the bloom bits set, its false positive rate
+    std::vector<uint64_t> sample;      // sorted ascending
+    uint64_t threshold = UINT64_MAX;   // UINT64_MAX when the sample holds every id
+};
+
+/**
+ * Finalizer from MurmurHash3, spreads the ids evenly over 64 bits.
+ */
+static inline uint64_t sketch_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline bool sketch_bloom_contains(const list_sketch& sketch, uint64_t hash) {
+    return (sketch.bloom[(hash >> 6) & (sketch.bloom.size() - 1)] >> (hash & 63)) & 1;
+}
+
+// Share of the hash space at or below the threshold
+static inline double sketch_sampling_rate(uint64_t threshold) {
+    return (static_cast<double>(threshold) + 1.0) / 18446744073709551616.0;
+}
+
+list_sketch build_sketch(const std::vector<uint64_t>& list) {
+    list_sketch sketch;
+    sketch.bloom.resize(SKETCH_BLOOM_MIN_WORDS);
+    if (list.empty()) {
+        return sketch;
+    }
+    sketch.min = list.front();
+    sketch.max = list.back();
+
+    size_t words = std::bit_ceil(list.size() * SKETCH_BLOOM_BITS_PER_ID / 64);
+    sketch.bloom.resize(std::clamp(words, SKETCH_BLOOM_MIN_WORDS, SKETCH_BLOOM_MAX_WORDS));
+
+    std::vector<uint64_t> hashes;
+    hashes.reserve(list.size());
+    for (auto id : list) {
+        uint64_t hash = sketch_hash(id);
+        sketch.bloom[(hash >> 6) & (sketch.bloom.size() - 1)] |= 1ULL << (hash & 63);
+        hashes.push_back(hash);
+    }
+    size_t set = 0;
+    for (auto word : sketch.bloom) {
+        set += static_cast<size_t>(std::popcount(word));
+    }
+    sketch.bloom_fill = static_cast<double>(set) / static_cast<double>(sketch.bloom.size() * 64);
+    if (sketch.bloom_fill > SKETCH_BLOOM_MAX_FILL) {
+        sketch.bloom.clear();
+        sketch.bloom.shrink_to_fit();
+    }
+
+    // duplicates in the list hash to the same value, so unique keeps the sample over distinct ids
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    if (hashes.size() > SKETCH_SAMPLE_SIZE) {
+        hashes.resize(SKETCH_SAMPLE_SIZE);
+        hashes.shrink_to_fit();
+        sketch.threshold = hashes.back();
+    }
+    sketch.sample = std::move(hashes);
+    return sketch;
+}
+
+std::vector<list_sketch> build_sketches(const std::vector<std::vector<uint64_t>>& nums) {
+    std::vector<list_sketch> sketches;
+    sketches.reserve(nums.size());
+    for (auto& list : nums) {
+        sketches.emplace_back(build_sketch(list));
+    }
+    return sketches;
+}
+
+/**
+ * Returns true only if the intersection of the lists is provably empty.
+ * The lists themselves are never touched. The bloom check stops at the first
+ * bit all the filters share, so only a rejection reads the whole smallest filter.
+ */
+bool sketches_disjoint(const std::vector<list_sketch>& sketches) {
+    if (sketches.empty()) {
+        return true;
+    }
+
+    // 1. Any empty list means an empty intersection
+    for (auto& sketch : sketches) {
+        if (sketch.sample.empty()) {
+            return true;
+        }
+    }
+
+    // 2. The value ranges must all overlap
+    uint64_t low = sketches[0].min;
+    uint64_t high = sketches[0].max;
+    for (auto& sketch : sketches) {
+        low = std::max(low, sketch.min);
+        high = std::min(high, sketch.max);
+    }
+    if (low > high) {
+        return true;
+    }
+
+    // 3. A common id sets the same bloom bit in every list. Larger filters fold onto
+    // the smallest one by OR-ing the words that share the low bits of their index.
+    // The sparsest filters go first, they zero the candidate bits soonest.
+    // The lists whose filter was dropped may hold any id, so they are left out.
+    std::vector<const list_sketch *> order;
+    for (auto& sketch : sketches) {
+        if (!sketch.bloom.empty()) {
+            order.push_back(&sketch);
+        }
+    }
+    if (order.empty()) {
+        return false;
+    }
+    std::sort(order.begin(), order.end(), [](auto left, auto right) { return left->bloom_fill < right->bloom_fill; });
+    size_t words = SKETCH_BLOOM_MAX_WORDS;
+    for (auto sketch : order) {
+        words = std::min(words, sketch->bloom.size());
+    }
+
+    for (size_t word = 0; word < words; ++word) {
+        uint64_t bits = ~0ULL;
+        for (auto sketch : order) {
+            uint64_t folded = 0;
+            for (size_t i = word; i < sketch->bloom.size(); i += words) {
+                folded |= sketch->bloom[i];
+            }
+            bits &= folded;
+            if (bits == 0) {
+                break;
+            }
+        }
+        if (bits != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Distinct count estimate, exact when the list has at most SKETCH_SAMPLE_SIZE distinct ids.
+ */
+double estimate_distinct(const list_sketch& sketch) {
+    if (sketch.threshold == UINT64_MAX) {
+        return static_cast<double>(sketch.sample.size());
+    }
+    // kth smallest hash as a fraction of the hash space
+    return static_cast<double>(sketch.sample.size() - 1) / sketch_sampling_rate(sketch.threshold);
+}
+
+/**
+ * Estimates the number of distinct ids common to all lists without touching the lists.
+ *
+ * The sampled hashes of the smallest list are checked against every other list:
+ * exactly against its sample when the hash is at or below its threshold, otherwise
+ * against its bloom filter. A bloom hit is only right 1 - fill of the time, so
+ * each bloom answer x counts as (x - fill) / (1 - fill), which is unbiased, and
+ * the fill is at most SKETCH_BLOOM_MAX_FILL so 1 - fill never gets near 0.
+ * A list without a filter can only answer up to its own threshold, so the probes
+ * stop there: this is the plain KMV estimate, unbiased but noisy when the common
+ * ids are a small share of that list.
+ * The sum over the probes, scaled by the sampling rate of the last probe threshold,
+ * estimates the intersection.
+ * Small lists are sampled in full and the estimate is then exact up to the bloom noise.
+ */
+double estimate_intersection_size(const std::vector<list_sketch>& sketches) {
+    if (sketches_disjoint(sketches)) {
+        return 0.0;
+    }
+
+    auto lead = std::min_element(sketches.begin(), sketches.end(), [](auto& left, auto& right) {
+        return estimate_distinct(left) < estimate_distinct(right);
+    });
+
+    uint64_t threshold = lead->threshold;
+    for (auto& sketch : sketches) {
+        if (sketch.bloom.empty()) {
+            threshold = std::min(threshold, sketch.threshold);
+        }
+    }
+    auto probes = static_cast<size_t>(std::upper_bound(lead->sample.begin(), lead->sample.end(), threshold) - lead->sample.begin());
+
+    std::vector<size_t> cursors(sketches.size(), 0);
+    double total = 0;
+    for (size_t probe = 0; probe < probes; ++probe) {
+        uint64_t hash = lead->sample[probe];
+        double weight = 1.0;
+        for (size_t i = 0; i < sketches.size() && weight != 0.0; ++i) {
+            auto& sketch = sketches[i];
+            if (&sketch == &*lead) {
+                continue;
+            }
+            if (hash <= sketch.threshold) {
+                // the probes are ascending, so each sample gallops on from where the last probe stopped
+                size_t& at = cursors[i];
+                if (at < sketch.sample.size() && sketch.sample[at] < hash) {
+                    at = frog_advance_until(sketch.sample.data(), at, sketch.sample.size(), hash);
+                }
+                weight = (at < sketch.sample.size() && sketch.sample[at] == hash) ? weight : 0.0;
+            } else {
+                double hit = sketch_bloom_contains(sketch, hash) ? 1.0 : 0.0;
+                weight *= (hit - sketch.bloom_fill) / (1.0 - sketch.bloom_fill);
+            }
+        }
+        total += weight;
+    }
+
+    double rate = threshold == UINT64_MAX ? 1.0 : sketch_sampling_rate(threshold);
+    return std::max(0.0, total / rate);
+}
+
+/**
+ * Galloping search that first asks the sketches if the answer is provably empty.
+ * The sketches describe the same lists as nums, the order does not matter.
+ */
+std::vector<uint64_t> using_sketches_and_galloping_search(std::vector<std::vector<uint64_t>>& nums,
+                                                          const std::vector<list_sketch>& sketches) {
+    if (sketches_disjoint(sketches)) {
+        return {};
+    }
+    return using_galloping_search(nums);
+}
+
+#endif //MULTIPLE_INTERSECTIONS_SKETCHES_H
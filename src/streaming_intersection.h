@@ -0,0 +1,361 @@
+/*
+ * Copyright Max De Marzi. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MULTIPLE_INTERSECTIONS_STREAMING_INTERSECTION_H
+#define MULTIPLE_INTERSECTIONS_STREAMING_INTERSECTION_H
+
+#include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "galloping_search.h"
+#include "less_branching.h"
+
+// 64K ids = 512KB per chunk, a multiple of the page size so every read is aligned
+const size_t STREAMING_CHUNK_IDS = 65536;
+const size_t STREAMING_ALIGNMENT = 4096;
+const size_t NO_CHUNK = SIZE_MAX;
+
+/**
+ * A sorted list on disk is the raw uint64_t ids in one file, plus a small
+ * block index next to it (path + ".idx"): the ids per chunk, the number of ids,
+ * then the max id of every chunk.
+ */
+void write_sorted_list(const std::string& path, const std::vector<uint64_t>& ids,
+                       size_t chunk_ids = STREAMING_CHUNK_IDS) {
+    if (chunk_ids == 0) {
+        throw std::invalid_argument("chunk_ids must be at least 1");
+    }
+    std::ofstream data(path, std::ios::binary | std::ios::trunc);
+    data.write(reinterpret_cast<const char *>(ids.data()), static_cast<std::streamsize>(ids.size() * sizeof(uint64_t)));
+
+    std::vector<uint64_t> index = {chunk_ids, ids.size()};
+    for (size_t end = chunk_ids; end < ids.size() + chunk_ids; end += chunk_ids) {
+        index.push_back(ids[std::min(end, ids.size()) - 1]);
+    }
+    std::ofstream index_file(path + ".idx", std::ios::binary | std::ios::trunc);
+    index_file.write(reinterpret_cast<const char *>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint64_t)));
+    if (!data || !index_file) {
+        throw std::runtime_error("could not write " + path);
+    }
+}
+
+/**
+ * Reads one sorted list chunk by chunk with bounded memory: two aligned chunk buffers.
+ * While the caller works on one, a background thread reads the next chunk into the other.
+ * Chunks can be skipped with the block index. The caller says which chunk it wants next
+ * (load and prefetch), and a chunk that was not read ahead is read into the free
+ * buffer without waiting for a read ahead that is no longer wanted.
+ */
+class chunked_list_reader {
+public:
+    explicit chunked_list_reader(const std::string& path) {
+        std::ifstream index_file(path + ".idx", std::ios::binary);
+        uint64_t header[2] = {0, 0};
+        index_file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!index_file || header[0] == 0) {
+            throw std::runtime_error("could not read the block index of " + path);
+        }
+        chunk_ids_ = header[0];
+        ids_ = header[1];
+        maxes_.resize((ids_ + chunk_ids_ - 1) / chunk_ids_);
+        index_file.read(reinterpret_cast<char *>(maxes_.data()), static_cast<std::streamsize>(maxes_.size() * sizeof(uint64_t)));
+        if (!index_file) {
+            throw std::runtime_error("could not read the block index of " + path);
+        }
+
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            throw std::runtime_error("could not open " + path);
+        }
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        size_t bytes = (chunk_ids_ * sizeof(uint64_t) + STREAMING_ALIGNMENT - 1) / STREAMING_ALIGNMENT * STREAMING_ALIGNMENT;
+        for (auto& buffer : buffers_) {
+            buffer = static_cast<uint64_t *>(std::aligned_alloc(STREAMING_ALIGNMENT, bytes));
+            if (buffer == nullptr) {
+                release();
+                throw std::bad_alloc();
+            }
+        }
+        try {
+            worker_ = std::thread([this] { read_ahead(); });
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ~chunked_list_reader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+        release();
+    }
+
+    chunked_list_reader(const chunked_list_reader&) = delete;
+    chunked_list_reader& operator=(const chunked_list_reader&) = delete;
+
+    size_t size() const { return ids_; }
+    size_t chunks() const { return maxes_.size(); }
+    uint64_t chunk_max(size_t chunk) const { return maxes_[chunk]; }
+
+    // First chunk at or after chunk that can hold an id >= min, or chunks() if none
+    size_t chunk_for(size_t chunk, uint64_t min) const {
+        return static_cast<size_t>(std::lower_bound(maxes_.begin() + static_cast<std::ptrdiff_t>(chunk), maxes_.end(), min) - maxes_.begin());
+    }
+
+    /**
+     * The ids of a chunk. The span stays valid until the next call, which also
+     * starts reading `next` (by default the chunk after this one) in the background.
+     * Only a read ahead of this very chunk is waited for.
+     */
+    std::span<const uint64_t> load(size_t chunk, size_t next = NO_CHUNK) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this, chunk] { return reading_ != chunk; });
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+
+        size_t other = 1 - current_;
+        if (loaded_[other] == chunk) {
+            current_ = other;
+        } else {
+            // not the chunk we read ahead, the caller skipped. The background thread only
+            // writes the other buffer, so this one is read right here without the lock.
+            pending_ = NO_CHUNK;
+            loaded_[current_] = NO_CHUNK;
+            lock.unlock();
+            read_chunk(chunk, buffers_[current_]);
+            lock.lock();
+            loaded_[current_] = chunk;
+        }
+
+        request(next == NO_CHUNK ? chunk + 1 : next);
+        return {buffers_[current_], chunk_length(chunk)};
+    }
+
+    /**
+     * Moves the read ahead to another chunk, when the caller learns it will skip.
+     * A read already under way still finishes, but nobody waits for it.
+     */
+    void prefetch(size_t chunk) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request(chunk);
+    }
+
+private:
+    // With the lock held: queue a chunk for the background thread unless it is on its way
+    void request(size_t chunk) {
+        if (chunk >= chunks() || reading_ == chunk || loaded_[1 - current_] == chunk) {
+            pending_ = NO_CHUNK;
+            return;
+        }
+        pending_ = chunk;
+        wake_.notify_one();
+    }
+
+    // The file and the buffers, also undone by hand when the constructor throws halfway
+    void release() {
+        close(fd_);
+        for (auto buffer : buffers_) {
+            std::free(buffer);
+        }
+    }
+
+    size_t chunk_length(size_t chunk) const {
+        return std::min(chunk_ids_, ids_ - chunk * chunk_ids_);
+    }
+
+    void read_chunk(size_t chunk, uint64_t * into) const {
+        auto * bytes = reinterpret_cast<char *>(into);
+        size_t wanted = chunk_length(chunk) * sizeof(uint64_t);
+        auto offset = static_cast<off_t>(chunk * chunk_ids_ * sizeof(uint64_t));
+        size_t done = 0;
+        while (done < wanted) {
+            ssize_t got = pread(fd_, bytes + done, wanted - done, offset + static_cast<off_t>(done));
+            if (got <= 0) {
+                throw std::runtime_error("could not read chunk " + std::to_string(chunk));
+            }
+            done += static_cast<size_t>(got);
+        }
+    }
+
+    void read_ahead() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stop_ || pending_ != NO_CHUNK; });
+            if (stop_) {
+                return;
+            }
+            size_t chunk = std::exchange(pending_, NO_CHUNK);
+            size_t buffer = 1 - current_;
+            reading_ = chunk;
+            loaded_[buffer] = NO_CHUNK;
+            lock.unlock();
+            try {
+                read_chunk(chunk, buffers_[buffer]);
+            } catch (...) {
+                // handed to the caller by the next load()
+                error_ = std::current_exception();
+            }
+            lock.lock();
+            loaded_[buffer] = error_ ? NO_CHUNK : chunk;
+            reading_ = NO_CHUNK;
+            done_.notify_one();
+        }
+    }
+
+    int fd_ = -1;
+    size_t chunk_ids_ = 0;
+    size_t ids_ = 0;
+    std::vector<uint64_t> maxes_;
+
+    std::array<uint64_t *, 2> buffers_{};
+    std::array<size_t, 2> loaded_ = {NO_CHUNK, NO_CHUNK};
+    size_t current_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    size_t pending_ = NO_CHUNK;   // the next chunk for the background thread
+    size_t reading_ = NO_CHUNK;   // the chunk it is reading into the other buffer
+    std::exception_ptr error_;
+    bool stop_ = false;
+    std::thread worker_;
+};
+
+/**
+ * K-way intersection of sorted lists on disk. The ids of each list must be unique.
+ *
+ * Each round works on a window that ends at the lowest max of the current chunks:
+ * every id up to it is already in memory, so the window slices go through the
+ * pairwise kernels and the matches go to the sink. The chunks that run out move
+ * on, and the block index skips any chunk that ends below the highest id still
+ * waiting in another list. Every round each reader is told the chunk it is most
+ * likely to need next, so the read ahead follows the skips.
+ *
+ * sink(const uint64_t * ids, size_t count) is called with the matches of each window.
+ * Returns the number of matches.
+ */
+template <typename Sink>
+size_t streaming_intersection(const std::vector<std::string>& paths, Sink&& sink) {
+    std::vector<std::unique_ptr<chunked_list_reader>> readers;
+    for (auto& path : paths) {
+        readers.emplace_back(std::make_unique<chunked_list_reader>(path));
+        if (readers.back()->size() == 0) {
+            return 0;
+        }
+    }
+    if (readers.empty()) {
+        return 0;
+    }
+
+    const size_t k = readers.size();
+    std::vector<size_t> chunks(k, 0);
+    std::vector<size_t> positions(k, 0);
+    std::vector<std::span<const uint64_t>> data(k);
+    for (size_t i = 0; i < k; ++i) {
+        data[i] = readers[i]->load(0);
+    }
+
+    std::vector<std::span<const uint64_t>> slices(k);
+    std::vector<uint64_t> scratch;
+    size_t total = 0;
+    while (true) {
+        // 1. The window ends at the lowest chunk max
+        uint64_t high = readers[0]->chunk_max(chunks[0]);
+        for (size_t i = 1; i < k; ++i) {
+            high = std::min(high, readers[i]->chunk_max(chunks[i]));
+        }
+
+        // 2. Intersect the slices up to it, the smallest one first
+        for (size_t i = 0; i < k; ++i) {
+            auto begin = data[i].begin() + static_cast<std::ptrdiff_t>(positions[i]);
+            auto end = std::upper_bound(begin, data[i].end(), high);
+            slices[i] = std::span<const uint64_t>(begin, end);
+            positions[i] = static_cast<size_t>(end - data[i].begin());
+        }
+        std::sort(slices.begin(), slices.end(), [](auto& left, auto& right) { return left.size() < right.size(); });
+
+        scratch.assign(slices[0].begin(), slices[0].end());
+        for (size_t i = 1; i < k && !scratch.empty(); ++i) {
+            size_t length;
+            if (slices[i].size() / 32 > scratch.size()) {
+                length = onesided_galloping_intersection(scratch.data(), scratch.size(),
+                                                         slices[i].data(), slices[i].size(), scratch.data());
+            } else {
+                length = scalar_branchless_unrolled(scratch.data(), scratch.size(),
+                                                    slices[i].data(), slices[i].size(), scratch.data());
+            }
+            scratch.resize(length);
+        }
+        if (!scratch.empty()) {
+            sink(scratch.data(), scratch.size());
+            total += scratch.size();
+        }
+
+        // 3. Everything up to high is done, so the next match is at least the highest waiting id
+        uint64_t low = high + 1;
+        for (size_t i = 0; i < k; ++i) {
+            if (positions[i] < data[i].size()) {
+                low = std::max(low, data[i][positions[i]]);
+            }
+        }
+
+        // 4. Lists whose chunk ran out jump to the first chunk that can reach low.
+        // low only grows, so that chunk is also the best guess for the ones still going.
+        for (size_t i = 0; i < k; ++i) {
+            size_t next = readers[i]->chunk_for(chunks[i] + 1, low);
+            if (positions[i] < data[i].size()) {
+                readers[i]->prefetch(next);
+                continue;
+            }
+            chunks[i] = next;
+            if (chunks[i] == readers[i]->chunks()) {
+                return total;
+            }
+            data[i] = readers[i]->load(chunks[i], readers[i]->chunk_for(chunks[i] + 1, low));
+            positions[i] = static_cast<size_t>(std::lower_bound(data[i].begin(), data[i].end(), low) - data[i].begin());
+        }
+    }
+}
+
+std::vector<uint64_t> using_streaming_intersection(const std::vector<std::string>& paths) {
+    std::vector<uint64_t> result;
+    streaming_intersection(paths, [&result](const uint64_t * ids, size_t count) {
+        result.insert(result.end(), ids, ids + count);
+    });
+    return result;
+}
+
+#endif //MULTIPLE_INTERSECTIONS_STREAMING_INTERSECTION_H
@@ -16,12 +16,23 @@
 
 #include <catch2/catch.hpp>
 #include <set>
+#include <cmath>
+#include <random>
+#include <filesystem>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include "std_set_intersection.h"
 #include "binary_search.h"
 #include "less_branching.h"
 #include "galloping_search.h"
+#include "sketches.h"
+#include "block_index.h"
+#include "intersection_view.h"
+#include "fixed_k_intersection.h"
+#include "set_operations.h"
+#include "instrumentation.h"
+#include "streaming_intersection.h"
 
 TEST_CASE("using_ranges_set_intersection is correct", "[ranges_set_intersection]") {
     std::vector<uint64_t> test = {1,3,5,7,9};
@@ -88,4 +99,548 @@ TEST_CASE("all are correct", "[all]") {
     result = using_galloping_search(nums);
     REQUIRE(result.size() == 4);
     REQUIRE(result == expected);
-}
\ No newline at end of file
+    auto lists = build_block_index(nums);
+    result = using_block_index(lists);
+    REQUIRE(result.size() == 4);
+    REQUIRE(result == expected);
+    result = using_intersection_view(nums);
+    REQUIRE(result.size() == 4);
+    REQUIRE(result == expected);
+    result = using_fixed_k(nums);
+    REQUIRE(result.size() == 4);
+    REQUIRE(result == expected);
+}
+
+TEST_CASE("using_fixed_k is correct for every list count", "[fixed_k]") {
+    // list i holds the multiples of i + 1, so the answer is the multiples of all of them
+    std::vector<std::vector<uint64_t>> lists;
+    for (uint64_t i = 0; i < 10; i++) {
+        std::vector<uint64_t> multiples;
+        for (uint64_t id = 0; id < 5000; id += i + 1) {
+            multiples.push_back(id);
+        }
+        lists.push_back(multiples);
+    }
+
+    for (size_t k = 1; k <= lists.size(); k++) {
+        std::vector<std::vector<uint64_t>> nums(lists.begin(), lists.begin() + static_cast<long>(k));
+        std::vector<uint64_t> expected = nums[0];
+        for (size_t i = 1; i < k; i++) {
+            std::vector<uint64_t> intersection;
+            std::ranges::set_intersection(expected, nums[i], back_inserter(intersection));
+            expected = intersection;
+        }
+        REQUIRE(using_fixed_k(nums) == expected);
+    }
+
+    // the smallest list past the first 8 must not bound the output of the 8 list kernel
+    std::vector<uint64_t> hundred(100);
+    std::iota(hundred.begin(), hundred.end(), 1);
+    for (size_t k = 9; k <= 10; k++) {
+        std::vector<std::vector<uint64_t>> nums(k - 1, hundred);
+        nums.push_back({1});
+        REQUIRE(using_fixed_k(nums) == std::vector<uint64_t>{1});
+    }
+}
+
+TEST_CASE("using_block_index skips blocks and is correct", "[block_index]") {
+    // clusters that only sometimes overlap, spanning many blocks
+    std::vector<uint64_t> test;
+    std::vector<uint64_t> test2;
+    std::vector<uint64_t> test3;
+    for (uint64_t cluster = 0; cluster < 50; cluster++) {
+        for (uint64_t i = 0; i < 100; i++) {
+            test.push_back(cluster * 1000 + i);
+            if (cluster % 3 == 0) test2.push_back(cluster * 1000 + 2 * i);
+            if (cluster % 2 == 0) test3.push_back(cluster * 1000 + 500 + i);
+        }
+        test3.push_back(cluster * 1000 + 10);
+        std::sort(test3.begin(), test3.end());
+    }
+    std::vector<std::vector<uint64_t>> nums = {test, test2};
+    std::vector<uint64_t> expected;
+    std::ranges::set_intersection(test, test2, back_inserter(expected));
+    auto lists = build_block_index(nums);
+    REQUIRE(using_block_index(lists) == expected);
+
+    nums = {test, test2, test3};
+    std::vector<uint64_t> expected3;
+    std::ranges::set_intersection(expected, test3, back_inserter(expected3));
+    REQUIRE(expected3.size() == 17);
+    lists = build_block_index(nums);
+    REQUIRE(using_block_index(lists) == expected3);
+
+    // another driver reorders nums first, the index still pairs every list with its own maxes
+    lists = build_block_index(nums);
+    std::reverse(lists.begin(), lists.end());
+    REQUIRE(using_galloping_search(nums) == expected3);
+    REQUIRE(using_block_index(lists) == expected3);
+
+    // maxes that claim block 0 of the first list ends below 1000 hide the 1000 in it,
+    // so only a kernel that skipped the block without reading it misses that match
+    std::vector<uint64_t> first(64);
+    std::iota(first.begin(), first.end(), 0);
+    first.back() = 1000;
+    first.push_back(2000);
+    std::vector<uint64_t> second = {1000, 2000};
+    std::vector<uint64_t> out(2);
+    auto hidden = build_block_maxes(first.data(), first.size());
+    REQUIRE(block_skipping_intersection(first.data(), first.size(), hidden.data(),
+                                        second.data(), second.size(), build_block_maxes(second.data(), second.size()).data(),
+                                        out.data()) == 2);
+    hidden[0] = 999;
+    REQUIRE(block_skipping_intersection(first.data(), first.size(), hidden.data(),
+                                        second.data(), second.size(), build_block_maxes(second.data(), second.size()).data(),
+                                        out.data()) == 1);
+    REQUIRE(out[0] == 2000);
+}
+
+TEST_CASE("sketches reject disjoint lists", "[sketches]") {
+    std::vector<uint64_t> low = {1,3,5,7,9};
+    std::vector<uint64_t> high = {10,12,14};
+    std::vector<uint64_t> evens = {2,4,6,8};
+    std::vector<uint64_t> empty = {};
+
+    REQUIRE(sketches_disjoint(build_sketches({low, high})));
+    REQUIRE(sketches_disjoint(build_sketches({low, evens})));
+    REQUIRE(sketches_disjoint(build_sketches({low, empty})));
+
+    std::vector<std::vector<uint64_t>> nums = {low, evens};
+    REQUIRE(using_sketches_and_galloping_search(nums, build_sketches(nums)).empty());
+}
+
+TEST_CASE("sketches never reject lists with a common id", "[sketches]") {
+    std::vector<uint64_t> test = {1,3,5,7,9};
+    std::vector<uint64_t> test2 = {3,6,8,9,32};
+    std::vector<uint64_t> test3 = {0,9,100};
+    std::vector<std::vector<uint64_t>> nums = {test, test2, test3};
+    auto sketches = build_sketches(nums);
+
+    REQUIRE_FALSE(sketches_disjoint(sketches));
+    REQUIRE(estimate_intersection_size(sketches) == 1.0);
+    std::vector<uint64_t> expected = {9};
+    REQUIRE(using_sketches_and_galloping_search(nums, sketches) == expected);
+}
+
+// Lists of the given sizes that share a core of `common` ids, the rest are spread over 2^40
+static std::vector<std::vector<uint64_t>> lists_with_common(const std::vector<size_t>& sizes, size_t common, std::mt19937_64& random_engine) {
+    std::uniform_int_distribution<uint64_t> pick(1, 1ULL << 40);
+    std::set<uint64_t> core;
+    while (core.size() < common) {
+        core.insert(pick(random_engine));
+    }
+    std::vector<std::vector<uint64_t>> nums;
+    for (auto size : sizes) {
+        std::set<uint64_t> list(core.begin(), core.end());
+        while (list.size() < size) {
+            list.insert(pick(random_engine));
+        }
+        nums.emplace_back(list.begin(), list.end());
+    }
+    return nums;
+}
+
+TEST_CASE("sketches estimate large intersections", "[sketches]") {
+    std::vector<uint64_t> first;
+    std::vector<uint64_t> second;
+    for (uint64_t i = 0; i < 100000; i++) {
+        first.push_back(i);
+        second.push_back(i + 50000);
+    }
+    auto sketches = build_sketches({first, second});
+
+    REQUIRE(estimate_distinct(sketches[0]) == Approx(100000).epsilon(0.05));
+    REQUIRE(estimate_intersection_size(sketches) == Approx(50000).epsilon(0.1));
+}
+
+TEST_CASE("sketches estimate skewed and k way intersections", "[sketches]") {
+    std::mt19937_64 random_engine{26};
+    const std::vector<std::pair<std::vector<size_t>, size_t>> shapes = {
+            {{50000, 50000, 50000}, 15000},
+            {{100, 100000}, 30},
+            {{1000, 100000}, 300},
+            {{500, 20000, 50000, 100000}, 150},
+            {{5000, 5000, 5000}, 1500},
+    };
+    for (auto& [sizes, common] : shapes) {
+        double total_error = 0;
+        double worst_error = 0;
+        for (size_t trial = 0; trial < 10; trial++) {
+            auto nums = lists_with_common(sizes, common, random_engine);
+            auto sketches = build_sketches(nums);
+            auto exact = static_cast<double>(using_less_branching(nums).size());
+            double error = std::abs(estimate_intersection_size(sketches) - exact) / exact;
+            total_error += error;
+            worst_error = std::max(worst_error, error);
+        }
+        REQUIRE(total_error / 10 < 0.1);
+        REQUIRE(worst_error < 0.3);
+    }
+}
+
+TEST_CASE("sketches of lists past the bloom cap", "[sketches]") {
+    // 5M ids fill the 512KB filter to about 0.7, 8M fill it past SKETCH_BLOOM_MAX_FILL
+    std::vector<uint64_t> large;
+    for (uint64_t id = 0; id < 10000000; id += 2) {
+        large.push_back(id);
+    }
+    std::vector<uint64_t> larger;
+    for (uint64_t id = 0; id < 16000000; id += 2) {
+        larger.push_back(id);
+    }
+    auto large_sketch = build_sketch(large);
+    auto larger_sketch = build_sketch(larger);
+    REQUIRE(large_sketch.bloom.size() == SKETCH_BLOOM_MAX_WORDS);
+    REQUIRE(larger_sketch.bloom.empty());
+    REQUIRE(large_sketch.sample.size() == SKETCH_SAMPLE_SIZE);
+    REQUIRE(larger_sketch.sample.size() == SKETCH_SAMPLE_SIZE);
+    REQUIRE(estimate_distinct(larger_sketch) == Approx(8000000).epsilon(0.05));
+
+    // 300 ids of 1000 in common, even ids are in the lists and odd ids are not
+    std::mt19937_64 random_engine{26};
+    std::uniform_int_distribution<uint64_t> pick(0, 4999999);
+    double total_error = 0;
+    for (size_t trial = 0; trial < 10; trial++) {
+        std::set<uint64_t> small;
+        while (small.size() < 300) {
+            small.insert(pick(random_engine) * 2);
+        }
+        while (small.size() < 1000) {
+            small.insert(pick(random_engine) * 2 + 1);
+        }
+        std::vector<uint64_t> list(small.begin(), small.end());
+        double estimate = estimate_intersection_size({build_sketch(list), large_sketch});
+        total_error += std::abs(estimate - 300) / 300;
+        // a dropped filter answers nothing, the estimate falls back to the samples and stays a number
+        double fallback = estimate_intersection_size({build_sketch(list), larger_sketch});
+        REQUIRE(std::isfinite(fallback));
+        REQUIRE(fallback >= 0);
+        REQUIRE_FALSE(sketches_disjoint({build_sketch(list), larger_sketch}));
+    }
+    REQUIRE(total_error / 10 < 0.3);
+
+    // half of a 1M list is in the 8M one, enough for the samples alone
+    std::vector<uint64_t> half(1000000);
+    std::iota(half.begin(), half.end(), 0);
+    REQUIRE(estimate_intersection_size({build_sketch(half), larger_sketch}) == Approx(500000).epsilon(0.2));
+}
+
+TEST_CASE("intersection_view is lazy and composable", "[intersection_view]") {
+    std::vector<uint64_t> test = {1,3,5,7,9,11,13,15};
+    std::vector<uint64_t> test2 = {1,3,6,7,8,9,13,15,32};
+    std::vector<uint64_t> test3 = {0,1,3,9,13,15,100};
+    std::vector<std::vector<uint64_t>> nums = {test, test2, test3};
+
+    std::vector<uint64_t> expected = {1,3,9,13,15};
+    REQUIRE(using_intersection_view(nums) == expected);
+
+    std::vector<uint64_t> first = {1,3};
+    REQUIRE(using_intersection_view_first(nums, 2) == first);
+
+    std::vector<uint64_t> result;
+    for (auto id : intersection_view(nums)) {
+        if (id > 9) break;
+        result.push_back(id);
+    }
+    std::vector<uint64_t> up_to_nine = {1,3,9};
+    REQUIRE(result == up_to_nine);
+
+    // a filter and a second intersection stacked on the first one
+    std::vector<uint64_t> test4 = {3,4,9,15};
+    std::vector<std::vector<uint64_t>> pair = {test, test2};
+    result.clear();
+    for (auto id : intersection_view(pair) | std::views::filter([](uint64_t id) { return id > 1; })
+                   | intersect_with(test4)) {
+        result.push_back(id);
+    }
+    std::vector<uint64_t> stacked = {3,9,15};
+    REQUIRE(result == stacked);
+
+    std::vector<std::vector<uint64_t>> with_empty = {test, {}};
+    REQUIRE(intersection_view(with_empty).begin() == std::default_sentinel);
+}
+
+// Sorted ids from a small range so most of them repeat, like the benchmark data
+static std::vector<uint64_t> sorted_with_repeats(size_t size, uint64_t high, std::mt19937_64& random_engine) {
+    std::uniform_int_distribution<uint64_t> pick(1, high);
+    std::vector<uint64_t> list(size);
+    for (auto& id : list) {
+        id = pick(random_engine);
+    }
+    std::ranges::sort(list);
+    return list;
+}
+
+TEST_CASE("intersection_view keeps repeats like the pairwise merges", "[intersection_view]") {
+    std::vector<uint64_t> test = {1,3,3,3,5,7,7,9};
+    std::vector<uint64_t> test2 = {3,3,5,7,7,7,9,9};
+    std::vector<std::vector<uint64_t>> nums = {test, test2};
+    std::vector<uint64_t> expected = {3,3,5,7,7,9};
+    REQUIRE(using_intersection_view(nums) == expected);
+
+    std::mt19937_64 random_engine{28};
+    for (size_t trial = 0; trial < 500; trial++) {
+        size_t lists = 2 + trial % 4;
+        std::vector<std::vector<uint64_t>> repeats;
+        for (size_t i = 0; i < lists; i++) {
+            repeats.emplace_back(sorted_with_repeats(50 + (trial * 37 + i * 101) % 400, 64, random_engine));
+        }
+        auto copy = repeats;
+        auto result = using_intersection_view(repeats);
+        REQUIRE(result == using_less_branching(copy));
+
+        std::vector<uint64_t> piped;
+        for (auto id : repeats[0] | intersect_with(repeats[1])) {
+            piped.push_back(id);
+        }
+        std::vector<std::vector<uint64_t>> pair = {repeats[0], repeats[1]};
+        REQUIRE(piped == using_less_branching(pair));
+    }
+}
+
+TEST_CASE("set operations match the std algorithms", "[set_operations]") {
+    std::vector<uint64_t> test = {1,3,5,7,9,11,13,15};
+    std::vector<uint64_t> test2 = {1,3,6,7,8,9,13,15,32};
+    std::vector<uint64_t> test3 = {0,1,2,3,40};
+    std::vector<std::vector<uint64_t>> nums = {test, test2, test3};
+
+    std::vector<uint64_t> difference = {5,11};
+    REQUIRE(using_std_set_difference(nums) == difference);
+    REQUIRE(using_less_branching_difference(nums) == difference);
+    REQUIRE(using_galloping_difference(nums) == difference);
+
+    std::vector<uint64_t> unioned = {0,1,2,3,5,6,7,8,9,11,13,15,32,40};
+    REQUIRE(using_std_set_union(nums) == unioned);
+    REQUIRE(using_less_branching_union(nums) == unioned);
+    REQUIRE(using_heap_union(nums) == unioned);
+
+    // in an odd number of the lists
+    std::vector<uint64_t> symmetric = {0,1,2,3,5,6,8,11,32,40};
+    REQUIRE(using_less_branching_symmetric_difference(nums) == symmetric);
+
+    // small list against a large one, with the large list running out first and last
+    std::vector<uint64_t> large;
+    for (uint64_t id = 0; id < 10000; id += 3) {
+        large.push_back(id);
+    }
+    for (auto& small : std::vector<std::vector<uint64_t>>{{1,3,4,9,5000,9999}, {3,9999,20000,20001}, {}}) {
+        std::vector<uint64_t> expected;
+        std::ranges::set_difference(small, large, back_inserter(expected));
+        std::vector<uint64_t> out(small.size());
+        out.resize(onesided_galloping_difference(small.data(), small.size(), large.data(), large.size(), out.data()));
+        REQUIRE(out == expected);
+        out.resize(small.size());
+        out.resize(scalar_branchless_difference(small.data(), small.size(), large.data(), large.size(), out.data()));
+        REQUIRE(out == expected);
+    }
+}
+
+TEST_CASE("unions agree on repeated ids", "[set_operations]") {
+    std::vector<uint64_t> test = {1,3,3,3,5};
+    std::vector<uint64_t> test2 = {3,3,5,5,7};
+    std::vector<uint64_t> test3 = {0,3,7,7,7};
+    std::vector<std::vector<uint64_t>> nums = {test, test2, test3};
+    std::vector<uint64_t> unioned = {0,1,3,3,3,5,5,7,7,7};
+    REQUIRE(using_std_set_union(nums) == unioned);
+    REQUIRE(using_less_branching_union(nums) == unioned);
+    REQUIRE(using_heap_union(nums) == unioned);
+
+    std::mt19937_64 random_engine{30};
+    for (size_t trial = 0; trial < 500; trial++) {
+        std::vector<std::vector<uint64_t>> repeats;
+        for (size_t i = 0; i < 2 + trial % 6; i++) {
+            repeats.emplace_back(sorted_with_repeats((trial * 37 + i * 101) % 300, 64, random_engine));
+        }
+        auto expected = using_std_set_union(repeats);
+        REQUIRE(using_less_branching_union(repeats) == expected);
+        REQUIRE(using_heap_union(repeats) == expected);
+    }
+}
+
+TEST_CASE("differences agree with std::set_difference on repeated ids", "[set_operations]") {
+    std::vector<uint64_t> small = {3,3,3,7,9,9};
+    std::vector<uint64_t> large = {1,2,3,3,4,5,6,7,8,9,10,11,12,13};
+    std::vector<uint64_t> expected = {3,9};
+    std::vector<uint64_t> out(small.size());
+    out.resize(onesided_galloping_difference(small.data(), small.size(), large.data(), large.size(), out.data()));
+    REQUIRE(out == expected);
+
+    std::mt19937_64 random_engine{31};
+    for (size_t trial = 0; trial < 2000; trial++) {
+        auto first = sorted_with_repeats(1 + trial % 40, 64, random_engine);
+        auto second = sorted_with_repeats((trial * 37) % 500, 64, random_engine);
+        expected.clear();
+        std::ranges::set_difference(first, second, back_inserter(expected));
+
+        out.resize(first.size());
+        out.resize(onesided_galloping_difference(first.data(), first.size(), second.data(), second.size(), out.data()));
+        REQUIRE(out == expected);
+        out.resize(first.size());
+        out.resize(scalar_branchless_difference(first.data(), first.size(), second.data(), second.size(), out.data()));
+        REQUIRE(out == expected);
+
+        std::vector<std::vector<uint64_t>> nums = {first, second};
+        REQUIRE(using_galloping_difference(nums) == expected);
+        REQUIRE(using_less_branching_difference(nums) == expected);
+    }
+
+    // in place, with B running out while Out is still level with A
+    for (auto& ahead : std::vector<std::vector<uint64_t>>{{}, {1}, {1,2}, {1,2,5}}) {
+        std::vector<uint64_t> in_place = {5,6,7};
+        expected.clear();
+        std::ranges::set_difference(in_place, ahead, back_inserter(expected));
+        in_place.resize(onesided_galloping_difference(in_place.data(), in_place.size(), ahead.data(), ahead.size(), in_place.data()));
+        REQUIRE(in_place == expected);
+        in_place = {5,6,7};
+        in_place.resize(scalar_branchless_difference(in_place.data(), in_place.size(), ahead.data(), ahead.size(), in_place.data()));
+        REQUIRE(in_place == expected);
+    }
+}
+
+TEST_CASE("instrumented kernels count their work", "[instrumentation]") {
+    std::vector<uint64_t> test = {3,9,500,1000};
+    std::vector<uint64_t> test2;
+    for (uint64_t id = 0; id < 1000; id++) {
+        test2.push_back(id);
+    }
+    std::vector<uint64_t> expected = {3,9,500};
+
+    auto before = snapshot_instrumentation();
+    std::vector<std::vector<uint64_t>> nums = {test, test2};
+    REQUIRE(using_galloping_search<thread_instrumentation>(nums) == expected);
+    nums = {test, test2};
+    REQUIRE(using_less_branching<thread_instrumentation>(nums) == expected);
+    nums = {test, test2};
+    REQUIRE(using_binary_search<thread_instrumentation>(nums) == expected);
+    auto after = snapshot_instrumentation();
+
+    auto& galloping = after[GALLOPING_KERNEL];
+    REQUIRE(galloping.calls - before[GALLOPING_KERNEL].calls == 1);
+    REQUIRE(galloping.output - before[GALLOPING_KERNEL].output == 3);
+    REQUIRE(galloping.gallop_steps > before[GALLOPING_KERNEL].gallop_steps);
+    REQUIRE(galloping.skipped - before[GALLOPING_KERNEL].skipped > 900);
+    REQUIRE(galloping.latency.total - before[GALLOPING_KERNEL].latency.total == 1);
+
+    auto& branchless = after[BRANCHLESS_KERNEL];
+    REQUIRE(branchless.calls - before[BRANCHLESS_KERNEL].calls == 1);
+    REQUIRE(branchless.output - before[BRANCHLESS_KERNEL].output == 3);
+    REQUIRE(branchless.comparisons - before[BRANCHLESS_KERNEL].comparisons == 1000);
+    REQUIRE(branchless.skipped == before[BRANCHLESS_KERNEL].skipped);
+
+    auto& binary = after[BINARY_SEARCH_KERNEL];
+    REQUIRE(binary.search_steps > before[BINARY_SEARCH_KERNEL].search_steps);
+    REQUIRE(binary.output - before[BINARY_SEARCH_KERNEL].output == 3);
+
+    // the kernels past the baseline ones take the same policy
+    before = snapshot_instrumentation();
+    nums = {test, test2};
+    auto lists = build_block_index(nums);
+    REQUIRE(using_block_index<thread_instrumentation>(lists) == expected);
+    REQUIRE(using_fixed_k<thread_instrumentation>(nums) == expected);
+    REQUIRE(using_intersection_view<thread_instrumentation>(nums) == expected);
+    REQUIRE(using_less_branching_difference<thread_instrumentation>(nums) == std::vector<uint64_t>{1000});
+    REQUIRE(using_galloping_difference<thread_instrumentation>(nums) == std::vector<uint64_t>{1000});
+    REQUIRE(using_less_branching_union<thread_instrumentation>(nums).size() == 1001);
+    REQUIRE(using_heap_union<thread_instrumentation>(nums).size() == 1001);
+    REQUIRE(using_less_branching_symmetric_difference<thread_instrumentation>(nums).size() == 998);
+    after = snapshot_instrumentation();
+
+    const std::vector<std::pair<kernel_id, uint64_t>> outputs = {
+            {BLOCK_SKIPPING_KERNEL, 3}, {FIXED_K_KERNEL, 3}, {INTERSECTION_VIEW_KERNEL, 3},
+            {BRANCHLESS_DIFFERENCE_KERNEL, 1}, {GALLOPING_DIFFERENCE_KERNEL, 1},
+            {BRANCHLESS_UNION_KERNEL, 1001}, {HEAP_UNION_KERNEL, 1001}, {BRANCHLESS_SYMMETRIC_DIFFERENCE_KERNEL, 998},
+    };
+    for (auto [kernel, output] : outputs) {
+        REQUIRE(after[kernel].calls - before[kernel].calls == 1);
+        REQUIRE(after[kernel].output - before[kernel].output == output);
+        REQUIRE(after[kernel].comparisons > before[kernel].comparisons);
+    }
+    REQUIRE(after[BLOCK_SKIPPING_KERNEL].skipped - before[BLOCK_SKIPPING_KERNEL].skipped > 400);
+    REQUIRE(after[INTERSECTION_VIEW_KERNEL].skipped - before[INTERSECTION_VIEW_KERNEL].skipped > 900);
+    // the branchless difference walks all of A and B up to 1000, one step per id of B
+    REQUIRE(after[BRANCHLESS_DIFFERENCE_KERNEL].comparisons - before[BRANCHLESS_DIFFERENCE_KERNEL].comparisons == 1000);
+}
+
+TEST_CASE("latency buckets stay within 1/16 of the value", "[instrumentation]") {
+    for (uint64_t value : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 1000ULL, 123456789ULL, 18446744073709551615ULL}) {
+        auto low = latency_bucket_value(latency_bucket(value));
+        REQUIRE(low <= value);
+        REQUIRE(value - low <= value / 16);
+    }
+
+    latency_histogram histogram;
+    for (uint64_t value = 1; value <= 1000; value++) {
+        histogram.record(value);
+    }
+    auto snapshot = histogram.snapshot();
+    REQUIRE(snapshot.total == 1000);
+    REQUIRE(snapshot.percentile(50) == Approx(500).epsilon(0.07));
+    REQUIRE(snapshot.percentile(99) == Approx(990).epsilon(0.07));
+    REQUIRE(snapshot.percentile(100) == 1000);
+}
+
+TEST_CASE("streaming_intersection matches the in memory kernels", "[streaming]") {
+    auto directory = std::filesystem::temp_directory_path();
+    std::vector<std::string> paths;
+    for (auto name : {"streaming_a.ids", "streaming_b.ids", "streaming_c.ids"}) {
+        paths.emplace_back((directory / name).string());
+    }
+
+    // tiny chunks of 4 ids so the lists span many chunks and most of b is skipped
+    std::vector<uint64_t> a, b, c;
+    for (uint64_t id = 1; id <= 300; id++) {
+        if (id % 2 == 0) a.push_back(id);
+        if (id % 3 == 0) c.push_back(id);
+    }
+    for (uint64_t id = 1; id <= 3000; id++) {
+        if (id % 5 == 0 && (id < 40 || id > 2900 || id % 25 == 0)) b.push_back(id);
+    }
+    write_sorted_list(paths[0], a, 4);
+    write_sorted_list(paths[1], b, 4);
+    write_sorted_list(paths[2], c, 4);
+
+    std::vector<std::vector<uint64_t>> nums = {a, b, c};
+    auto expected = using_galloping_search(nums);
+    REQUIRE_FALSE(expected.empty());
+    REQUIRE(using_streaming_intersection(paths) == expected);
+
+    chunked_list_reader reader(paths[1]);
+    REQUIRE(reader.size() == b.size());
+    REQUIRE(reader.chunks() == (b.size() + 3) / 4);
+    size_t chunk = reader.chunk_for(0, 2901);
+    REQUIRE(reader.load(chunk)[0] <= 2905);
+    REQUIRE(reader.chunk_for(0, 3001) == reader.chunks());
+
+    // skips the read ahead guessed right, guessed wrong, or was moved to after the load
+    for (size_t skip = 1; skip <= 5; skip++) {
+        chunked_list_reader skipping(paths[1]);
+        for (size_t at = 0; at < skipping.chunks(); at += skip) {
+            auto ids = skipping.load(at, at % 3 == 0 ? NO_CHUNK : at + skip);
+            if (at % 3 == 1) {
+                skipping.prefetch(at + skip);
+            }
+            REQUIRE(ids.size() == std::min<size_t>(4, b.size() - at * 4));
+            REQUIRE(std::equal(ids.begin(), ids.end(), b.begin() + static_cast<std::ptrdiff_t>(at * 4)));
+        }
+    }
+
+    // a list past the end of the others, and a pair with nothing in common
+    REQUIRE(using_streaming_intersection({paths[0], paths[0]}) == a);
+    write_sorted_list(paths[2], {1001, 1003, 1005}, 4);
+    REQUIRE(using_streaming_intersection(paths).empty());
+
+    // no chunk size, and an index that asks for buffers no allocator can give
+    REQUIRE_THROWS_AS(write_sorted_list(paths[0], a, 0), std::invalid_argument);
+    write_sorted_list(paths[0], {1, 2, 3}, 4);
+    {
+        std::vector<uint64_t> index = {1ULL << 60, 3, 3};
+        std::ofstream index_file(paths[0] + ".idx", std::ios::binary | std::ios::trunc);
+        index_file.write(reinterpret_cast<const char *>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint64_t)));
+    }
+    REQUIRE_THROWS_AS(chunked_list_reader(paths[0]), std::bad_alloc);
+
+    for (auto& path : paths) {
+        std::filesystem::remove(path);
+        std::filesystem::remove(path + ".idx");
+    }
+}